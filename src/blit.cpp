@@ -0,0 +1,890 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "basetypes.h"
+#include "logs.h"
+#include "blit.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__i386__) || defined(__x86_64__)
+#define BLIT_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BLIT_NEON
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#if defined(__arm__)
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace MpvGui {
+
+typedef struct {
+	BLIT_KERNEL     kernel;
+	const char      *name;
+	void            (*blendMaskSpan)(U32 *dst, const U8 *mask, U32 color, S32 count);
+	void            (*blendImageSpan)(U32 *dst, const U32 *src, S32 count);
+	void            (*sdfCoverageSpan)(U8 *dst, const U8 *src, S32 sharpness, S32 count);
+	void            (*copySpan)(U8 *dst, const U8 *src, U32 bytes);
+	void            (*moveSpan)(U8 *dst, const U8 *src, U32 bytes);
+	void            (*doubleSpan)(U32 *dst, const U32 *src, S32 count);
+	void            (*hashSpan)(U64 *acc, const U8 *src, U32 bytes);
+} BlitKernels;
+
+// Exact x / 255 rounded, valid for x <= 255 * 255
+static inline U32 div255(U32 x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline U32 scalePixel(U32 color, U32 scale) {
+	return div255((color >> 24) * scale) << 24 |
+	       div255(((color >> 16) & 0xff) * scale) << 16 |
+	       div255(((color >> 8) & 0xff) * scale) << 8 |
+	       div255((color & 0xff) * scale);
+}
+
+static inline U32 blendPixel(U32 dst, U32 src) {
+	U32 invAlpha = 255 - (src >> 24);
+	U32 result = 0;
+
+	for (int shift = 0; shift < 32; shift += 8) {
+		U32 c = ((src >> shift) & 0xff) + div255(((dst >> shift) & 0xff) * invAlpha);
+		result |= MIN(c, 255) << shift;
+	}
+	return result;
+}
+
+static U32 premultiply(U32 color) {
+	U32 alpha = color >> 24;
+	return (alpha << 24) | (scalePixel(color, alpha) & 0xffffff);
+}
+
+static void blendMaskSpanScalar(U32 *dst, const U8 *mask, U32 color, S32 count) {
+	for (S32 i = 0; i < count; i++) {
+		if (mask[i])
+			dst[i] = blendPixel(dst[i], scalePixel(color, mask[i]));
+	}
+}
+
+static void blendImageSpanScalar(U32 *dst, const U32 *src, S32 count) {
+	for (S32 i = 0; i < count; i++) {
+		U32 s = src[i];
+		if ((s >> 24) == 255)
+			dst[i] = s;
+		else if (s)
+			dst[i] = blendPixel(dst[i], s);
+	}
+}
+
+static void sdfCoverageSpanScalar(U8 *dst, const U8 *src, S32 sharpness, S32 count) {
+	for (S32 i = 0; i < count; i++) {
+		S32 value = (((S32)src[i] - 128) * sharpness) >> 8;
+		dst[i] = CLIP(value + 128, 0, 255);
+	}
+}
+
+static void copySpanScalar(U8 *dst, const U8 *src, U32 bytes) {
+	memcpy(dst, src, bytes);
+}
+
+// Spans never overlap, moves within one surface go row by row
+static void moveSpanScalar(U8 *dst, const U8 *src, U32 bytes) {
+	memcpy(dst, src, bytes);
+}
+
+// Writes every source pixel twice, dst receives 2 * count pixels
+static void doubleSpanScalar(U32 *dst, const U32 *src, S32 count) {
+	for (S32 i = 0; i < count; i++) {
+		dst[i * 2] = dst[i * 2 + 1] = src[i];
+	}
+}
+
+#define HASH_SPAN_BYTES      256
+#define HASH_LANES           4
+
+// One key per 8 byte word of span, pixels moved within span change hash
+static const U64 hashKeys[HASH_SPAN_BYTES / 8] = {
+	0xc4bb895c608099f6ULL, 0xd7f20e07ed4202edULL, 0x03ed3511d7ec202aULL, 0xee544eeb36cbb404ULL,
+	0x4e0433b7df28434dULL, 0x793bfb39a2ef283aULL, 0xdba8b6150ada35d1ULL, 0xc1e3efacf3f5fa17ULL,
+	0x08e369b041747c23ULL, 0x9092a4d94e4f86d7ULL, 0x189d51ec6c90847fULL, 0xdbcf34d896a8dab3ULL,
+	0x936e0b4f1fd8218aULL, 0xba9e5c47afca1560ULL, 0x32776fead50db719ULL, 0xf6a6c4118327575bULL,
+	0xf1fb2337cb61c8adULL, 0x50c4d7db9ffeafc4ULL, 0xeb2842b9d326e9c2ULL, 0x8c7d38462e52011aULL,
+	0x8384a7f75bd2470bULL, 0x864f96bf782a3ae8ULL, 0xe220bb921a9eb423ULL, 0xd563fe7ef91d8131ULL,
+	0xad952622a2d2d4bbULL, 0x99bdb0511925535aULL, 0x5b3627fc9530d168ULL, 0x5a6c49686a17d220ULL,
+	0xad16dc33307c4826ULL, 0x9e5f21092932df25ULL, 0x128c999d75f34990ULL, 0x6748960b1203c22dULL,
+};
+
+// Word i goes to lane i % 4, mixed as data + low * high half of data ^ key.
+// Vector kernels compute same per lane and leave words of partial block here.
+static void hashWords(U64 *acc, const U8 *src, U32 start, U32 bytes) {
+	for (U32 i = start; i < bytes; i += 8) {
+		U64 word = 0;
+		memcpy(&word, src + i, MIN(8, bytes - i));
+		U64 mixed = word ^ hashKeys[i / 8];
+		acc[(i / 8) % HASH_LANES] += word + (mixed & 0xffffffff) * (mixed >> 32);
+	}
+}
+
+// Span is at most HASH_SPAN_BYTES long
+static void hashSpanScalar(U64 *acc, const U8 *src, U32 bytes) {
+	hashWords(acc, src, 0, bytes);
+}
+
+#if defined(BLIT_X86)
+
+static inline __m128i div255Sse2(__m128i x) {
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// dst and src are two pixels unpacked to 16-bit channels
+static inline __m128i blendSse2(__m128i dst, __m128i src) {
+	__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xff), 0xff);
+	__m128i invAlpha = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+	return _mm_add_epi16(src, div255Sse2(_mm_mullo_epi16(dst, invAlpha)));
+}
+
+static void blendMaskSpanSse2(U32 *dst, const U8 *mask, U32 color, S32 count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i color16 = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+	S32 i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		U32 m4;
+		memcpy(&m4, mask + i, 4);
+		if (!m4)
+			continue;
+		__m128i m = _mm_cvtsi32_si128(m4);
+		m = _mm_unpacklo_epi8(m, m);
+		m = _mm_unpacklo_epi16(m, m);
+		__m128i srcLo = div255Sse2(_mm_mullo_epi16(color16, _mm_unpacklo_epi8(m, zero)));
+		__m128i srcHi = div255Sse2(_mm_mullo_epi16(color16, _mm_unpackhi_epi8(m, zero)));
+		__m128i d = _mm_loadu_si128((__m128i *)(dst + i));
+		__m128i lo = blendSse2(_mm_unpacklo_epi8(d, zero), srcLo);
+		__m128i hi = blendSse2(_mm_unpackhi_epi8(d, zero), srcHi);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	blendMaskSpanScalar(dst + i, mask + i, color, count - i);
+}
+
+static void blendImageSpanSse2(U32 *dst, const U32 *src, S32 count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i alphaMask = _mm_set1_epi32(0xff000000);
+	S32 i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff)
+			continue;
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alphaMask), alphaMask)) == 0xffff) {
+			_mm_storeu_si128((__m128i *)(dst + i), s);
+			continue;
+		}
+		__m128i d = _mm_loadu_si128((__m128i *)(dst + i));
+		__m128i lo = blendSse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+		__m128i hi = blendSse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	blendImageSpanScalar(dst + i, src + i, count - i);
+}
+
+// (src - 128) << 8 fits 16 bits, so mulhi gives ((src - 128) * sharpness) >> 8
+static void sdfCoverageSpanSse2(U8 *dst, const U8 *src, S32 sharpness, S32 count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i bias = _mm_set1_epi16(128);
+	__m128i factor = _mm_set1_epi16(sharpness);
+	S32 i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias), 8);
+		__m128i hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias), 8);
+		lo = _mm_add_epi16(_mm_mulhi_epi16(lo, factor), bias);
+		hi = _mm_add_epi16(_mm_mulhi_epi16(hi, factor), bias);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	sdfCoverageSpanScalar(dst + i, src + i, sharpness, count - i);
+}
+
+// Streaming stores bypass cache, destination is write-combined scanout memory
+static void copySpanSse2(U8 *dst, const U8 *src, U32 bytes) {
+	U32 head = MIN((16 - ((uintptr_t)dst & 15)) & 15, bytes);
+	U32 i = head;
+
+	memcpy(dst, src, head);
+	for (; i + 64 <= bytes; i += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+		_mm_stream_si128((__m128i *)(dst + i), a);
+		_mm_stream_si128((__m128i *)(dst + i + 16), b);
+		_mm_stream_si128((__m128i *)(dst + i + 32), c);
+		_mm_stream_si128((__m128i *)(dst + i + 48), d);
+	}
+	for (; i + 16 <= bytes; i += 16) {
+		_mm_stream_si128((__m128i *)(dst + i), _mm_loadu_si128((const __m128i *)(src + i)));
+	}
+	memcpy(dst + i, src + i, bytes - i);
+}
+
+// Regular stores, destination is cached memory read again by following blits
+static void moveSpanSse2(U8 *dst, const U8 *src, U32 bytes) {
+	U32 i = 0;
+
+	for (; i + 64 <= bytes; i += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+		_mm_storeu_si128((__m128i *)(dst + i), a);
+		_mm_storeu_si128((__m128i *)(dst + i + 16), b);
+		_mm_storeu_si128((__m128i *)(dst + i + 32), c);
+		_mm_storeu_si128((__m128i *)(dst + i + 48), d);
+	}
+	memcpy(dst + i, src + i, bytes - i);
+}
+
+static void hashSpanSse2(U64 *acc, const U8 *src, U32 bytes) {
+	__m128i acc0 = _mm_loadu_si128((const __m128i *)acc);
+	__m128i acc1 = _mm_loadu_si128((const __m128i *)(acc + 2));
+	U32 i = 0;
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m128i d0 = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i d1 = _mm_loadu_si128((const __m128i *)(src + i + 16));
+		__m128i m0 = _mm_xor_si128(d0, _mm_loadu_si128((const __m128i *)(hashKeys + i / 8)));
+		__m128i m1 = _mm_xor_si128(d1, _mm_loadu_si128((const __m128i *)(hashKeys + i / 8 + 2)));
+		acc0 = _mm_add_epi64(acc0, _mm_add_epi64(d0, _mm_mul_epu32(m0, _mm_srli_epi64(m0, 32))));
+		acc1 = _mm_add_epi64(acc1, _mm_add_epi64(d1, _mm_mul_epu32(m1, _mm_srli_epi64(m1, 32))));
+	}
+	_mm_storeu_si128((__m128i *)acc, acc0);
+	_mm_storeu_si128((__m128i *)(acc + 2), acc1);
+	hashWords(acc, src, i, bytes);
+}
+
+static void doubleSpanSse2(U32 *dst, const U32 *src, S32 count) {
+	S32 i = 0;
+
+	for (; i < count && ((uintptr_t)(dst + i * 2) & 15); i++) {
+		dst[i * 2] = dst[i * 2 + 1] = src[i];
+	}
+	if (((uintptr_t)(dst + i * 2) & 15) == 0) {
+		for (; i + 4 <= count; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+			_mm_stream_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi32(v, v));
+			_mm_stream_si128((__m128i *)(dst + i * 2 + 4), _mm_unpackhi_epi32(v, v));
+		}
+	}
+	doubleSpanScalar(dst + i * 2, src + i, count - i);
+}
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i div255Avx2(__m256i x) {
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+AVX2_TARGET static inline __m256i blendAvx2(__m256i dst, __m256i src) {
+	__m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xff), 0xff);
+	__m256i invAlpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+	return _mm256_add_epi16(src, div255Avx2(_mm256_mullo_epi16(dst, invAlpha)));
+}
+
+AVX2_TARGET static void blendMaskSpanAvx2(U32 *dst, const U8 *mask, U32 color, S32 count) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i color16 = _mm256_unpacklo_epi8(_mm256_set1_epi32(color), zero);
+	S32 i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		U64 m8;
+		memcpy(&m8, mask + i, 8);
+		if (!m8)
+			continue;
+		// replicate each coverage byte into all four channels of its pixel
+		__m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(mask + i)));
+		m = _mm256_mullo_epi32(m, _mm256_set1_epi32(0x01010101));
+		__m256i srcLo = div255Avx2(_mm256_mullo_epi16(color16, _mm256_unpacklo_epi8(m, zero)));
+		__m256i srcHi = div255Avx2(_mm256_mullo_epi16(color16, _mm256_unpackhi_epi8(m, zero)));
+		__m256i d = _mm256_loadu_si256((__m256i *)(dst + i));
+		__m256i lo = blendAvx2(_mm256_unpacklo_epi8(d, zero), srcLo);
+		__m256i hi = blendAvx2(_mm256_unpackhi_epi8(d, zero), srcHi);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	blendMaskSpanSse2(dst + i, mask + i, color, count - i);
+}
+
+AVX2_TARGET static void blendImageSpanAvx2(U32 *dst, const U32 *src, S32 count) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i alphaMask = _mm256_set1_epi32(0xff000000);
+	S32 i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		if (_mm256_testz_si256(s, s))
+			continue;
+		if ((U32)_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alphaMask), alphaMask)) == 0xffffffff) {
+			_mm256_storeu_si256((__m256i *)(dst + i), s);
+			continue;
+		}
+		__m256i d = _mm256_loadu_si256((__m256i *)(dst + i));
+		__m256i lo = blendAvx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero));
+		__m256i hi = blendAvx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	blendImageSpanSse2(dst + i, src + i, count - i);
+}
+
+AVX2_TARGET static void sdfCoverageSpanAvx2(U8 *dst, const U8 *src, S32 sharpness, S32 count) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i bias = _mm256_set1_epi16(128);
+	__m256i factor = _mm256_set1_epi16(sharpness);
+	S32 i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i lo = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_unpacklo_epi8(v, zero), bias), 8);
+		__m256i hi = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_unpackhi_epi8(v, zero), bias), 8);
+		lo = _mm256_add_epi16(_mm256_mulhi_epi16(lo, factor), bias);
+		hi = _mm256_add_epi16(_mm256_mulhi_epi16(hi, factor), bias);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	sdfCoverageSpanSse2(dst + i, src + i, sharpness, count - i);
+}
+
+AVX2_TARGET static void copySpanAvx2(U8 *dst, const U8 *src, U32 bytes) {
+	U32 head = MIN((32 - ((uintptr_t)dst & 31)) & 31, bytes);
+	U32 i = head;
+
+	memcpy(dst, src, head);
+	for (; i + 64 <= bytes; i += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+		_mm256_stream_si256((__m256i *)(dst + i), a);
+		_mm256_stream_si256((__m256i *)(dst + i + 32), b);
+	}
+	copySpanSse2(dst + i, src + i, bytes - i);
+}
+
+AVX2_TARGET static void moveSpanAvx2(U8 *dst, const U8 *src, U32 bytes) {
+	U32 i = 0;
+
+	for (; i + 64 <= bytes; i += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+		_mm256_storeu_si256((__m256i *)(dst + i), a);
+		_mm256_storeu_si256((__m256i *)(dst + i + 32), b);
+	}
+	moveSpanSse2(dst + i, src + i, bytes - i);
+}
+
+AVX2_TARGET static void hashSpanAvx2(U64 *acc, const U8 *src, U32 bytes) {
+	__m256i sum = _mm256_loadu_si256((const __m256i *)acc);
+	U32 i = 0;
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i d = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i m = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i *)(hashKeys + i / 8)));
+		sum = _mm256_add_epi64(sum, _mm256_add_epi64(d, _mm256_mul_epu32(m, _mm256_srli_epi64(m, 32))));
+	}
+	_mm256_storeu_si256((__m256i *)acc, sum);
+	hashWords(acc, src, i, bytes);
+}
+
+AVX2_TARGET static void doubleSpanAvx2(U32 *dst, const U32 *src, S32 count) {
+	__m256i lowIndex = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+	__m256i highIndex = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+	S32 i = 0;
+
+	for (; i < count && ((uintptr_t)(dst + i * 2) & 31); i++) {
+		dst[i * 2] = dst[i * 2 + 1] = src[i];
+	}
+	if (((uintptr_t)(dst + i * 2) & 31) == 0) {
+		for (; i + 8 <= count; i += 8) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+			_mm256_stream_si256((__m256i *)(dst + i * 2), _mm256_permutevar8x32_epi32(v, lowIndex));
+			_mm256_stream_si256((__m256i *)(dst + i * 2 + 8), _mm256_permutevar8x32_epi32(v, highIndex));
+		}
+	}
+	doubleSpanSse2(dst + i * 2, src + i, count - i);
+}
+
+#endif
+
+#if defined(BLIT_NEON)
+
+// Same rounding as div255(): (x + 128 + ((x + 128) >> 8)) >> 8
+static inline uint8x8_t div255Neon(uint16x8_t x) {
+	return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+
+static inline void blendNeon(uint8x8x4_t &dst, const uint8x8x4_t &src) {
+	uint8x8_t invAlpha = vmvn_u8(src.val[3]);
+	for (int c = 0; c < 4; c++) {
+		dst.val[c] = vqadd_u8(src.val[c], div255Neon(vmull_u8(dst.val[c], invAlpha)));
+	}
+}
+
+static void blendMaskSpanNeon(U32 *dst, const U8 *mask, U32 color, S32 count) {
+	uint8x8_t channels[4] = {
+		vdup_n_u8(color & 0xff), vdup_n_u8((color >> 8) & 0xff),
+		vdup_n_u8((color >> 16) & 0xff), vdup_n_u8(color >> 24)
+	};
+	S32 i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		uint8x8_t m = vld1_u8(mask + i);
+		if (vget_lane_u64(vreinterpret_u64_u8(m), 0) == 0)
+			continue;
+		uint8x8x4_t src;
+		for (int c = 0; c < 4; c++) {
+			src.val[c] = div255Neon(vmull_u8(channels[c], m));
+		}
+		uint8x8x4_t d = vld4_u8((const U8 *)(dst + i));
+		blendNeon(d, src);
+		vst4_u8((U8 *)(dst + i), d);
+	}
+	blendMaskSpanScalar(dst + i, mask + i, color, count - i);
+}
+
+static void blendImageSpanNeon(U32 *dst, const U32 *src, S32 count) {
+	S32 i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		uint8x8x4_t s = vld4_u8((const U8 *)(src + i));
+		uint8x8_t any = vorr_u8(vorr_u8(s.val[0], s.val[1]), vorr_u8(s.val[2], s.val[3]));
+		if (vget_lane_u64(vreinterpret_u64_u8(any), 0) == 0)
+			continue;
+		if (vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0) == ~0ULL) {
+			vst4_u8((U8 *)(dst + i), s);
+			continue;
+		}
+		uint8x8x4_t d = vld4_u8((const U8 *)(dst + i));
+		blendNeon(d, s);
+		vst4_u8((U8 *)(dst + i), d);
+	}
+	blendImageSpanScalar(dst + i, src + i, count - i);
+}
+
+static void sdfCoverageSpanNeon(U8 *dst, const U8 *src, S32 sharpness, S32 count) {
+	int16x4_t factor = vdup_n_s16(sharpness);
+	int16x8_t bias = vdupq_n_s16(128);
+	S32 i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src + i))), bias);
+		int16x8_t t = vcombine_s16(vshrn_n_s32(vmull_s16(vget_low_s16(v), factor), 8),
+		                           vshrn_n_s32(vmull_s16(vget_high_s16(v), factor), 8));
+		vst1_u8(dst + i, vqmovun_s16(vaddq_s16(t, bias)));
+	}
+	sdfCoverageSpanScalar(dst + i, src + i, sharpness, count - i);
+}
+
+// Full 64 byte bursts keep write-combining buffers filled completely
+static void copySpanNeon(U8 *dst, const U8 *src, U32 bytes) {
+	U32 i = 0;
+
+	for (; i + 64 <= bytes; i += 64) {
+		uint8x16_t a = vld1q_u8(src + i);
+		uint8x16_t b = vld1q_u8(src + i + 16);
+		uint8x16_t c = vld1q_u8(src + i + 32);
+		uint8x16_t d = vld1q_u8(src + i + 48);
+		vst1q_u8(dst + i, a);
+		vst1q_u8(dst + i + 16, b);
+		vst1q_u8(dst + i + 32, c);
+		vst1q_u8(dst + i + 48, d);
+	}
+	memcpy(dst + i, src + i, bytes - i);
+}
+
+static void doubleSpanNeon(U32 *dst, const U32 *src, S32 count) {
+	S32 i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		uint32x4_t v = vld1q_u32(src + i);
+		uint32x4x2_t pair = vzipq_u32(v, v);
+		vst1q_u32(dst + i * 2, pair.val[0]);
+		vst1q_u32(dst + i * 2 + 4, pair.val[1]);
+	}
+	doubleSpanScalar(dst + i * 2, src + i, count - i);
+}
+
+static void hashSpanNeon(U64 *acc, const U8 *src, U32 bytes) {
+	uint64x2_t acc0 = vld1q_u64((const uint64_t *)acc);
+	uint64x2_t acc1 = vld1q_u64((const uint64_t *)acc + 2);
+	U32 i = 0;
+
+	for (; i + 32 <= bytes; i += 32) {
+		uint64x2_t d0 = vreinterpretq_u64_u8(vld1q_u8(src + i));
+		uint64x2_t d1 = vreinterpretq_u64_u8(vld1q_u8(src + i + 16));
+		uint64x2_t m0 = veorq_u64(d0, vld1q_u64((const uint64_t *)hashKeys + i / 8));
+		uint64x2_t m1 = veorq_u64(d1, vld1q_u64((const uint64_t *)hashKeys + i / 8 + 2));
+		acc0 = vaddq_u64(acc0, vaddq_u64(d0, vmull_u32(vmovn_u64(m0), vshrn_n_u64(m0, 32))));
+		acc1 = vaddq_u64(acc1, vaddq_u64(d1, vmull_u32(vmovn_u64(m1), vshrn_n_u64(m1, 32))));
+	}
+	vst1q_u64((uint64_t *)acc, acc0);
+	vst1q_u64((uint64_t *)acc + 2, acc1);
+	hashWords(acc, src, i, bytes);
+}
+
+#endif
+
+static const BlitKernels kernelsList[] = {
+#if defined(BLIT_X86)
+	{ BLIT_KERNEL_AVX2, "avx2", blendMaskSpanAvx2, blendImageSpanAvx2, sdfCoverageSpanAvx2, copySpanAvx2, moveSpanAvx2, doubleSpanAvx2, hashSpanAvx2 },
+	{ BLIT_KERNEL_SSE2, "sse2", blendMaskSpanSse2, blendImageSpanSse2, sdfCoverageSpanSse2, copySpanSse2, moveSpanSse2, doubleSpanSse2, hashSpanSse2 },
+#endif
+#if defined(BLIT_NEON)
+	// plain NEON stores suit both uncached and cached destinations
+	{ BLIT_KERNEL_NEON, "neon", blendMaskSpanNeon, blendImageSpanNeon, sdfCoverageSpanNeon, copySpanNeon, copySpanNeon, doubleSpanNeon, hashSpanNeon },
+#endif
+	{ BLIT_KERNEL_SCALAR, "scalar", blendMaskSpanScalar, blendImageSpanScalar, sdfCoverageSpanScalar, copySpanScalar, moveSpanScalar, doubleSpanScalar, hashSpanScalar },
+};
+
+static const BlitKernels *kernels = &kernelsList[SIZE_OF_ARRAY(kernelsList) - 1];
+
+static bool cpuSupports(BLIT_KERNEL kernel) {
+	switch (kernel) {
+#if defined(BLIT_X86)
+	case BLIT_KERNEL_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case BLIT_KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+#if defined(BLIT_NEON)
+	case BLIT_KERNEL_NEON:
+#if defined(__arm__)
+		return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+		return true;
+#endif
+#endif
+	case BLIT_KERNEL_SCALAR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool BlitInit(BLIT_KERNEL kernel) {
+	// list is ordered from fastest to slowest
+	for (int i = 0; i < SIZE_OF_ARRAY(kernelsList); i++) {
+		if ((kernel == BLIT_KERNEL_AUTO || kernel == kernelsList[i].kernel) &&
+		    cpuSupports(kernelsList[i].kernel)) {
+			kernels = &kernelsList[i];
+			return true;
+		}
+	}
+
+	log->printf("BlitInit(): Kernel %d not supported!\n", kernel);
+	return false;
+}
+
+const char *BlitGetKernelName() {
+	return kernels->name;
+}
+
+static bool clipRect(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+                     U32 width, U32 height, Rect &rect) {
+	Rect bounds = { 0, 0, (S32)surface.width, (S32)surface.height };
+	rect = RectIntersect(RectIntersect(clip, bounds), { pos_x, pos_y, (S32)width, (S32)height });
+	return !RectIsEmpty(rect);
+}
+
+// Pixel format traits. 32-bit formats are blended in place by span kernels,
+// others are expanded to ARGB8888 in small chunks and packed back.
+struct FormatArgb8888 {
+	typedef U32 Pixel;
+	static const bool native = true;
+	static inline U32 toArgb(Pixel pixel) { return pixel; }
+	static inline Pixel fromArgb(U32 color) { return color; }
+};
+
+// Alpha byte is ignored by scanout, blending never reads destination alpha
+struct FormatXrgb8888 {
+	typedef U32 Pixel;
+	static const bool native = true;
+	static inline U32 toArgb(Pixel pixel) { return pixel | 0xff000000; }
+	static inline Pixel fromArgb(U32 color) { return color | 0xff000000; }
+};
+
+struct FormatRgb565 {
+	typedef U16 Pixel;
+	static const bool native = false;
+	static inline U32 toArgb(Pixel pixel) {
+		U32 r = (pixel >> 11) & 0x1f, g = (pixel >> 5) & 0x3f, b = pixel & 0x1f;
+		return 0xff000000 | ((r << 3) | (r >> 2)) << 16 | ((g << 2) | (g >> 4)) << 8 | ((b << 3) | (b >> 2));
+	}
+	// rounds to nearest representable value
+	static inline Pixel fromArgb(U32 color) {
+		U32 r = (color >> 16) & 0xff, g = (color >> 8) & 0xff, b = color & 0xff;
+		return ((r * 249 + 1014) >> 11) << 11 | ((g * 253 + 505) >> 10) << 5 | ((b * 249 + 1014) >> 11);
+	}
+};
+
+#define CHUNK_PIXELS 256
+
+template <class F>
+static void fillRect(const Surface &surface, const Rect &clip, const Rect &fill, U32 color) {
+	typedef typename F::Pixel Pixel;
+	Rect rect;
+
+	if (!clipRect(surface, clip, fill.x, fill.y, fill.width, fill.height, rect))
+		return;
+
+	Pixel value = color ? F::fromArgb(color) : 0;
+	U8 *dst = surface.ptr + rect.y * surface.stride + rect.x * sizeof(Pixel);
+	for (S32 y = 0; y < rect.height; y++) {
+		if (value == 0) {
+			memset(dst, 0, rect.width * sizeof(Pixel));
+		} else {
+			std::fill_n((Pixel *)dst, rect.width, value);
+		}
+		dst += surface.stride;
+	}
+}
+
+template <class F>
+static void blendMaskRect(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+                          const U8 *mask, U32 pitch, U32 width, U32 height, U32 color) {
+	typedef typename F::Pixel Pixel;
+	Rect rect;
+
+	if (!clipRect(surface, clip, pos_x, pos_y, width, height, rect))
+		return;
+
+	color = premultiply(color);
+	mask += (rect.y - pos_y) * pitch + (rect.x - pos_x);
+	U8 *dst = surface.ptr + rect.y * surface.stride + rect.x * sizeof(Pixel);
+	for (S32 y = 0; y < rect.height; y++) {
+		if (F::native) {
+			kernels->blendMaskSpan((U32 *)dst, mask, color, rect.width);
+		} else {
+			U32 tmp[CHUNK_PIXELS];
+			for (S32 x = 0; x < rect.width; x += CHUNK_PIXELS) {
+				Pixel *pixels = (Pixel *)dst + x;
+				S32 count = MIN(CHUNK_PIXELS, rect.width - x);
+				for (S32 i = 0; i < count; i++)
+					tmp[i] = F::toArgb(pixels[i]);
+				kernels->blendMaskSpan(tmp, mask + x, color, count);
+				for (S32 i = 0; i < count; i++)
+					pixels[i] = F::fromArgb(tmp[i]);
+			}
+		}
+		mask += pitch;
+		dst += surface.stride;
+	}
+}
+
+template <class F>
+static void blendImageRect(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+                           const U32 *image, U32 pitch, U32 width, U32 height) {
+	typedef typename F::Pixel Pixel;
+	Rect rect;
+
+	if (!clipRect(surface, clip, pos_x, pos_y, width, height, rect))
+		return;
+
+	image += (rect.y - pos_y) * pitch + (rect.x - pos_x);
+	U8 *dst = surface.ptr + rect.y * surface.stride + rect.x * sizeof(Pixel);
+	for (S32 y = 0; y < rect.height; y++) {
+		if (F::native) {
+			kernels->blendImageSpan((U32 *)dst, image, rect.width);
+		} else {
+			U32 tmp[CHUNK_PIXELS];
+			for (S32 x = 0; x < rect.width; x += CHUNK_PIXELS) {
+				Pixel *pixels = (Pixel *)dst + x;
+				S32 count = MIN(CHUNK_PIXELS, rect.width - x);
+				for (S32 i = 0; i < count; i++)
+					tmp[i] = F::toArgb(pixels[i]);
+				kernels->blendImageSpan(tmp, image + x, count);
+				for (S32 i = 0; i < count; i++)
+					pixels[i] = F::fromArgb(tmp[i]);
+			}
+		}
+		image += pitch;
+		dst += surface.stride;
+	}
+}
+
+template <class F>
+static void copyRect(const Surface &dst, const Surface &src, const Rect &copy) {
+	typedef typename F::Pixel Pixel;
+	Rect rect;
+
+	if (!clipRect(dst, { 0, 0, (S32)src.width, (S32)src.height }, copy.x, copy.y, copy.width, copy.height, rect))
+		return;
+
+	const U8 *srcPtr = src.ptr + rect.y * src.stride + rect.x * sizeof(Pixel);
+	U8 *dstPtr = dst.ptr + rect.y * dst.stride + rect.x * sizeof(Pixel);
+	for (S32 y = 0; y < rect.height; y++) {
+		kernels->copySpan(dstPtr, srcPtr, rect.width * sizeof(Pixel));
+		srcPtr += src.stride;
+		dstPtr += dst.stride;
+	}
+#if defined(BLIT_X86)
+	// order streaming stores before buffer is handed to display
+	_mm_sfence();
+#endif
+}
+
+// Shifts pixels inside rectangle vertically, rows uncovered by the move
+// keep old content. Rows are walked against direction of move, so each
+// source row is read before it is overwritten.
+template <class F>
+static void moveRect(const Surface &surface, const Rect &move, S32 dy) {
+	typedef typename F::Pixel Pixel;
+	Rect rect;
+
+	if (!clipRect(surface, move, move.x, move.y, move.width, move.height, rect))
+		return;
+	rect = RectIntersect(rect, { rect.x, rect.y + dy, rect.width, rect.height });
+	if (RectIsEmpty(rect))
+		return;
+
+	S32 step = dy > 0 ? -(S32)surface.stride : surface.stride;
+	S32 first = dy > 0 ? rect.y + rect.height - 1 : rect.y;
+	U8 *dstPtr = surface.ptr + first * surface.stride + rect.x * sizeof(Pixel);
+	const U8 *srcPtr = dstPtr - dy * (S32)surface.stride;
+	for (S32 y = 0; y < rect.height; y++) {
+		kernels->moveSpan(dstPtr, srcPtr, rect.width * sizeof(Pixel));
+		srcPtr += step;
+		dstPtr += step;
+	}
+}
+
+// Rect is in source coordinates, destination receives it at twice the size
+template <class F>
+static void scale2xRect(const Surface &dst, const Surface &src, const Rect &scale) {
+	typedef typename F::Pixel Pixel;
+	Rect rect;
+
+	if (!clipRect(src, { 0, 0, (S32)dst.width / 2, (S32)dst.height / 2 },
+	              scale.x, scale.y, scale.width, scale.height, rect))
+		return;
+
+	const U8 *srcPtr = src.ptr + rect.y * src.stride + rect.x * sizeof(Pixel);
+	U8 *dstPtr = dst.ptr + rect.y * 2 * dst.stride + rect.x * 2 * sizeof(Pixel);
+	for (S32 y = 0; y < rect.height; y++) {
+		// both rows are written from source, destination is not read back
+		for (S32 row = 0; row < 2; row++) {
+			if (sizeof(Pixel) == 4) {
+				kernels->doubleSpan((U32 *)dstPtr, (const U32 *)srcPtr, rect.width);
+			} else {
+				const Pixel *from = (const Pixel *)srcPtr;
+				Pixel *to = (Pixel *)dstPtr;
+				for (S32 x = 0; x < rect.width; x++) {
+					to[x * 2] = to[x * 2 + 1] = from[x];
+				}
+			}
+			dstPtr += dst.stride;
+		}
+		srcPtr += src.stride;
+	}
+#if defined(BLIT_X86)
+	_mm_sfence();
+#endif
+}
+
+#define BLIT_OPS(format, traits) \
+	{ format, fillRect<traits>, blendMaskRect<traits>, blendImageRect<traits>, copyRect<traits>, moveRect<traits>, scale2xRect<traits> }
+
+// indexed by PIXEL_FORMAT
+static const BlitOps opsList[] = {
+	BLIT_OPS(PIXEL_FORMAT_ARGB8888, FormatArgb8888),
+	BLIT_OPS(PIXEL_FORMAT_XRGB8888, FormatXrgb8888),
+	BLIT_OPS(PIXEL_FORMAT_RGB565, FormatRgb565),
+};
+
+const BlitOps *BlitGetOps(PIXEL_FORMAT format) {
+	return &opsList[format];
+}
+
+U32 BlitGetBytesPerPixel(PIXEL_FORMAT format) {
+	return format == PIXEL_FORMAT_RGB565 ? 2 : 4;
+}
+
+void BlitFill(const Surface &surface, const Rect &clip, const Rect &fill, U32 color) {
+	opsList[surface.format].fill(surface, clip, fill, color);
+}
+
+void BlitMask(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+              const U8 *mask, U32 pitch, U32 width, U32 height, U32 color) {
+	opsList[surface.format].mask(surface, clip, pos_x, pos_y, mask, pitch, width, height, color);
+}
+
+void BlitImage(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+               const U32 *image, U32 pitch, U32 width, U32 height) {
+	opsList[surface.format].image(surface, clip, pos_x, pos_y, image, pitch, width, height);
+}
+
+void BlitSdfCoverage(U8 *dst, const U8 *src, S32 sharpness, S32 count) {
+	kernels->sdfCoverageSpan(dst, src, sharpness, count);
+}
+
+void BlitCopy(const Surface &dst, const Surface &src, const Rect &copy) {
+	opsList[dst.format].copy(dst, src, copy);
+}
+
+void BlitMove(const Surface &surface, const Rect &rect, S32 dy) {
+	opsList[surface.format].move(surface, rect, dy);
+}
+
+void BlitScale2x(const Surface &dst, const Surface &src, const Rect &rect) {
+	opsList[dst.format].scale2x(dst, src, rect);
+}
+
+// Lanes are scrambled after each row so moving rows changes hash too,
+// result does not depend on kernels in use
+U64 BlitHash(const Surface &surface, const Rect &hash) {
+	U64 acc[HASH_LANES] = { 0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL };
+	U32 bpp = BlitGetBytesPerPixel(surface.format);
+	Rect rect;
+
+	if (!clipRect(surface, hash, hash.x, hash.y, hash.width, hash.height, rect))
+		return 0;
+
+	const U8 *src = surface.ptr + rect.y * surface.stride + rect.x * bpp;
+	U32 bytes = rect.width * bpp;
+	for (S32 y = 0; y < rect.height; y++) {
+		for (U32 i = 0; i < bytes; i += HASH_SPAN_BYTES)
+			kernels->hashSpan(acc, src + i, MIN(HASH_SPAN_BYTES, bytes - i));
+		for (int lane = 0; lane < HASH_LANES; lane++)
+			acc[lane] = (acc[lane] ^ (acc[lane] >> 29)) * 0xbf58476d1ce4e5b9ULL;
+		src += surface.stride;
+	}
+
+	U64 result = rect.width ^ (U64)rect.height << 32;
+	for (int lane = 0; lane < HASH_LANES; lane++)
+		result = (result ^ acc[lane]) * 0x94d049bb133111ebULL;
+
+	return result ^ (result >> 31);
+}
+
+} // namespace
@@ -0,0 +1,146 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef BLIT_H
+#define BLIT_H
+
+#include "basetypes.h"
+
+namespace MpvGui {
+
+typedef enum _BLIT_KERNEL {
+	BLIT_KERNEL_AUTO,
+	BLIT_KERNEL_SCALAR,
+	BLIT_KERNEL_SSE2,
+	BLIT_KERNEL_AVX2,
+	BLIT_KERNEL_NEON,
+} BLIT_KERNEL;
+
+// Order matches BlitGetOps() table
+typedef enum _PIXEL_FORMAT {
+	PIXEL_FORMAT_ARGB8888,
+	PIXEL_FORMAT_XRGB8888,
+	PIXEL_FORMAT_RGB565,
+} PIXEL_FORMAT;
+
+typedef struct {
+	S32             x;
+	S32             y;
+	S32             width;
+	S32             height;
+} Rect;
+
+// Target of blit operations, colors passed to blits are ARGB8888
+// and images premultiplied ARGB8888 regardless of surface format
+typedef struct {
+	U8              *ptr;
+	U32             width;
+	U32             height;
+	U32             stride;
+	PIXEL_FORMAT    format;
+} Surface;
+
+// Blit operations specialized for one pixel format
+typedef struct {
+	PIXEL_FORMAT    format;
+	void            (*fill)(const Surface &surface, const Rect &clip, const Rect &rect, U32 color);
+	void            (*mask)(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+	                        const U8 *mask, U32 pitch, U32 width, U32 height, U32 color);
+	void            (*image)(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+	                         const U32 *image, U32 pitch, U32 width, U32 height);
+	void            (*copy)(const Surface &dst, const Surface &src, const Rect &rect);
+	void            (*move)(const Surface &surface, const Rect &rect, S32 dy);
+	void            (*scale2x)(const Surface &dst, const Surface &src, const Rect &rect);
+} BlitOps;
+
+static inline Rect RectIntersect(const Rect &a, const Rect &b) {
+	S32 x1 = MAX(a.x, b.x);
+	S32 y1 = MAX(a.y, b.y);
+	S32 x2 = MIN(a.x + a.width, b.x + b.width);
+	S32 y2 = MIN(a.y + a.height, b.y + b.height);
+	if (x2 <= x1 || y2 <= y1)
+		return { 0, 0, 0, 0 };
+	return { x1, y1, x2 - x1, y2 - y1 };
+}
+
+static inline bool RectIsEmpty(const Rect &rect) {
+	return rect.width <= 0 || rect.height <= 0;
+}
+
+static inline Rect RectUnion(const Rect &a, const Rect &b) {
+	if (RectIsEmpty(a))
+		return b;
+	if (RectIsEmpty(b))
+		return a;
+	S32 x1 = MIN(a.x, b.x);
+	S32 y1 = MIN(a.y, b.y);
+	S32 x2 = MAX(a.x + a.width, b.x + b.width);
+	S32 y2 = MAX(a.y + a.height, b.y + b.height);
+	return { x1, y1, x2 - x1, y2 - y1 };
+}
+
+static inline bool RectEqual(const Rect &a, const Rect &b) {
+	return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+bool BlitInit(BLIT_KERNEL kernel);
+const char *BlitGetKernelName();
+
+// Callers drawing many items into one surface fetch ops once, functions
+// below dispatch on surface format for each call
+const BlitOps *BlitGetOps(PIXEL_FORMAT format);
+U32 BlitGetBytesPerPixel(PIXEL_FORMAT format);
+
+// Replaces clipped rectangle with solid ARGB8888 color
+void BlitFill(const Surface &surface, const Rect &clip, const Rect &rect, U32 color);
+
+// Source-over blend of solid color modulated by 8-bit coverage mask
+void BlitMask(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+              const U8 *mask, U32 pitch, U32 width, U32 height, U32 color);
+
+// Source-over blend of premultiplied ARGB8888 image, pitch in pixels
+void BlitImage(const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y,
+               const U32 *image, U32 pitch, U32 width, U32 height);
+
+// Copies rectangle between surfaces of same format, uses non-temporal
+// stores where available as destination is expected to be uncached
+void BlitCopy(const Surface &dst, const Surface &src, const Rect &rect);
+
+// Moves pixels of rectangle dy rows down (up when negative) within surface,
+// rows left uncovered are not touched. Regular cached stores, surface is
+// expected to be a readable shadow or back buffer.
+void BlitMove(const Surface &surface, const Rect &rect, S32 dy);
+
+// Pixel doubling of source rectangle into destination of twice the size,
+// rect is in source coordinates. Streaming stores as for BlitCopy.
+void BlitScale2x(const Surface &dst, const Surface &src, const Rect &rect);
+
+// 64-bit hash of pixels of clipped rectangle for finding changed areas,
+// reads surface so it is meant for cached memory
+U64 BlitHash(const Surface &surface, const Rect &rect);
+
+// Converts distance field samples (edge at 128) into coverage,
+// sharpness is 8.8 fixed point gain applied around the edge
+void BlitSdfCoverage(U8 *dst, const U8 *src, S32 sharpness, S32 count);
+
+} // namespace
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+
+// Standalone check of SIMD blit kernels against scalar ones, built with
+// "make blit-test". Random spans clipped at surface edges are drawn by each
+// kernel CPU supports and results are compared byte by byte, as are copies,
+// moves and 2x scales of random rects. Hashes of random rects have to
+// match exactly.
+
+#include "basetypes.h"
+#include "logs.h"
+#include "blit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+
+using namespace MpvGui;
+
+#define TEST_ITERATIONS  2000
+#define TEST_WIDTH       131
+#define TEST_HEIGHT      47
+
+static U32 seed = 1;
+
+static U32 random32() {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static S32 randomRange(S32 min, S32 max) {
+	return min + (S32)(random32() % (U32)(max - min + 1));
+}
+
+// Alpha often fully transparent or opaque, as in rendered glyphs
+static U32 randomPremultiplied() {
+	U32 a;
+	switch (random32() % 4) {
+	case 0: a = 0; break;
+	case 1: a = 255; break;
+	default: a = random32() & 0xff; break;
+	}
+	U32 r = random32() % (a + 1), g = random32() % (a + 1), b = random32() % (a + 1);
+	return a << 24 | r << 16 | g << 8 | b;
+}
+
+static Rect randomRect(S32 width, S32 height) {
+	S32 x = randomRange(-width / 2, width), y = randomRange(-height / 2, height);
+	return { x, y, randomRange(0, width), randomRange(0, height) };
+}
+
+// Surface contents are same for reference and tested kernel
+static void fillSurface(std::vector<U8> &pixels, const Surface &surface) {
+	for (U32 y = 0; y < surface.height; y++) {
+		for (U32 x = 0; x < surface.width; x++) {
+			U32 color = randomPremultiplied();
+			U8 *ptr = pixels.data() + y * surface.stride;
+			if (surface.format == PIXEL_FORMAT_RGB565)
+				((U16 *)ptr)[x] = color;
+			else
+				((U32 *)ptr)[x] = color;
+		}
+	}
+}
+
+static bool check(BLIT_KERNEL kernel, PIXEL_FORMAT format, const char *name,
+                  const std::function<void(const Surface &)> &blit) {
+	U32 stride = TEST_WIDTH * BlitGetBytesPerPixel(format) + 4 * randomRange(0, 3);
+	std::vector<U8> expected(stride * TEST_HEIGHT), result;
+	Surface surface = { nullptr, TEST_WIDTH, TEST_HEIGHT, stride, format };
+
+	fillSurface(expected, surface);
+	result = expected;
+
+	BlitInit(BLIT_KERNEL_SCALAR);
+	surface.ptr = expected.data();
+	blit(surface);
+	BlitInit(kernel);
+	surface.ptr = result.data();
+	blit(surface);
+
+	if (memcmp(expected.data(), result.data(), expected.size()) != 0) {
+		printf("%s: %s differs from scalar, format %d\n", BlitGetKernelName(), name, format);
+		return false;
+	}
+	return true;
+}
+
+static bool checkSpans(BLIT_KERNEL kernel, PIXEL_FORMAT format) {
+	for (int i = 0; i < TEST_ITERATIONS; i++) {
+		U32 width = randomRange(1, 80), height = randomRange(1, 20);
+		U32 pitch = width + randomRange(0, 8);
+		std::vector<U8> mask(pitch * height);
+		std::vector<U32> image(pitch * height);
+		for (auto &value : mask)
+			value = random32() % 3 ? random32() : (random32() & 1) * 255;
+		for (auto &value : image)
+			value = randomPremultiplied();
+		Rect clip = random32() % 2 ? Rect{ 0, 0, TEST_WIDTH, TEST_HEIGHT } : randomRect(TEST_WIDTH, TEST_HEIGHT);
+		S32 x = randomRange(-(S32)width, TEST_WIDTH), y = randomRange(-(S32)height, TEST_HEIGHT);
+		U32 color = random32();
+
+		if (!check(kernel, format, "BlitMask", [&](const Surface &surface) {
+			BlitMask(surface, clip, x, y, mask.data(), pitch, width, height, color);
+		}))
+			return false;
+		if (!check(kernel, format, "BlitImage", [&](const Surface &surface) {
+			BlitImage(surface, clip, x, y, image.data(), pitch, width, height);
+		}))
+			return false;
+	}
+
+	return true;
+}
+
+// Source is separate surface, move overlaps itself in both directions
+static bool checkCopies(BLIT_KERNEL kernel, PIXEL_FORMAT format) {
+	U32 stride = TEST_WIDTH * BlitGetBytesPerPixel(format) + 4 * randomRange(0, 3);
+	std::vector<U8> pixels(stride * TEST_HEIGHT);
+	Surface src = { pixels.data(), TEST_WIDTH, TEST_HEIGHT, stride, format };
+	fillSurface(pixels, src);
+
+	for (int i = 0; i < TEST_ITERATIONS; i++) {
+		Rect rect = random32() % 2 ? Rect{ 0, 0, TEST_WIDTH, TEST_HEIGHT } : randomRect(TEST_WIDTH, TEST_HEIGHT);
+		S32 dy = randomRange(-TEST_HEIGHT, TEST_HEIGHT);
+
+		if (!check(kernel, format, "BlitCopy", [&](const Surface &surface) {
+			BlitCopy(surface, src, rect);
+		}))
+			return false;
+		if (!check(kernel, format, "BlitMove", [&](const Surface &surface) {
+			BlitMove(surface, rect, dy);
+		}))
+			return false;
+		if (!check(kernel, format, "BlitScale2x", [&](const Surface &surface) {
+			BlitScale2x(surface, src, rect);
+		}))
+			return false;
+	}
+
+	return true;
+}
+
+// Tile diff compares hashes of frames, kernels have to agree on every bit
+static bool checkHash(BLIT_KERNEL kernel, PIXEL_FORMAT format) {
+	for (int i = 0; i < TEST_ITERATIONS; i++) {
+		U32 stride = TEST_WIDTH * BlitGetBytesPerPixel(format) + 4 * randomRange(0, 3);
+		std::vector<U8> pixels(stride * TEST_HEIGHT);
+		Surface surface = { pixels.data(), TEST_WIDTH, TEST_HEIGHT, stride, format };
+		fillSurface(pixels, surface);
+		Rect rect = randomRect(TEST_WIDTH, TEST_HEIGHT);
+
+		BlitInit(BLIT_KERNEL_SCALAR);
+		U64 expected = BlitHash(surface, rect);
+		BlitInit(kernel);
+		if (BlitHash(surface, rect) != expected) {
+			printf("%s: BlitHash differs from scalar, format %d\n", BlitGetKernelName(), format);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool checkSdfCoverage(BLIT_KERNEL kernel) {
+	for (int i = 0; i < TEST_ITERATIONS; i++) {
+		S32 count = randomRange(0, 100);
+		// glyphs scaled up from base size reach 32767
+		S32 sharpness = randomRange(0, 32767);
+		std::vector<U8> src(count), expected(count), result(count);
+		for (auto &value : src)
+			value = random32();
+
+		BlitInit(BLIT_KERNEL_SCALAR);
+		BlitSdfCoverage(expected.data(), src.data(), sharpness, count);
+		BlitInit(kernel);
+		BlitSdfCoverage(result.data(), src.data(), sharpness, count);
+		if (expected != result) {
+			printf("%s: BlitSdfCoverage differs from scalar\n", BlitGetKernelName());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const BLIT_KERNEL kernels[] = { BLIT_KERNEL_SSE2, BLIT_KERNEL_AVX2, BLIT_KERNEL_NEON };
+	const PIXEL_FORMAT formats[] = { PIXEL_FORMAT_ARGB8888, PIXEL_FORMAT_XRGB8888, PIXEL_FORMAT_RGB565 };
+	int failed = 0, tested = 0;
+
+	if (CreateLogs() == S_FAIL)
+		return 1;
+
+	for (BLIT_KERNEL kernel : kernels) {
+		if (!BlitInit(kernel))
+			continue;
+		const char *name = BlitGetKernelName();
+		bool passed = checkSdfCoverage(kernel);
+		for (PIXEL_FORMAT format : formats) {
+			passed = checkSpans(kernel, format) && passed;
+			passed = checkCopies(kernel, format) && passed;
+			passed = checkHash(kernel, format) && passed;
+		}
+		printf("%-6s %s\n", name, passed ? "ok" : "FAILED");
+		failed += !passed;
+		tested++;
+	}
+	if (tested == 0)
+		printf("No SIMD kernels supported, nothing to compare\n");
+
+	delete log;
+
+	return failed ? 1 : 0;
+}
@@ -20,16 +20,292 @@
  */
 
 #include <assert.h>
+#include <time.h>
+#include <algorithm>
 
 #include "basetypes.h"
 #include "display_base.h"
 #include "display_drm.h"
+#include "display_drm_atomic.h"
 #include "display_sdl2.h"
+#include "display_headless.h"
+#include "logs.h"
 
 namespace MpvGui {
 
+U64 DisplayGetTimeUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 Display::Display() :
-		_initialized(false) {
+		_initialized(false), _mailbox(false), _shadowMode(DISPLAY_SHADOW_AUTO),
+		_requestedFormat(PIXEL_FORMAT_ARGB8888), _scaledRender(false), _tileDiff(false),
+		_frameRecordCount(0), _nextRecord{}, _refreshPeriod(0), _missedVblanks(0), _missedFrames(0) {
+}
+
+static void addRect(std::vector<Rect> &rects, const Rect &rect) {
+	Rect merged = rect;
+
+	// overlapping rectangles are merged to avoid drawing same pixels twice
+	for (int i = 0; i < rects.size(); ) {
+		if (!RectIsEmpty(RectIntersect(rects[i], merged))) {
+			merged = RectUnion(rects[i], merged);
+			rects.erase(rects.begin() + i);
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+	rects.push_back(merged);
+
+	if (rects.size() > DISPLAY_MAX_DAMAGE) {
+		for (int i = 1; i < rects.size(); i++) {
+			rects[0] = RectUnion(rects[0], rects[i]);
+		}
+		rects.resize(1);
+	}
+}
+
+void Display::addDamage(const Rect &rect) {
+	Rect screen = { 0, 0, (S32)getBufferWidth(), (S32)getBufferHeight() };
+	Rect clipped = RectIntersect(rect, screen);
+
+	if (!RectIsEmpty(clipped))
+		addRect(_damage, clipped);
+}
+
+void Display::addMovedDamage(const Rect &rect) {
+	Rect screen = { 0, 0, (S32)getBufferWidth(), (S32)getBufferHeight() };
+	Rect clipped = RectIntersect(rect, screen);
+
+	if (!RectIsEmpty(clipped))
+		addRect(_moved, clipped);
+}
+
+// Damage of current frame plus damage of frames presented since
+// buffer with given age was last used
+void Display::getDamageRegion(U32 age, std::vector<Rect> &region) {
+	Rect screen = { 0, 0, (S32)getBufferWidth(), (S32)getBufferHeight() };
+
+	region.clear();
+	if (age == 0 || age - 1 > DISPLAY_DAMAGE_HISTORY) {
+		region.push_back(screen);
+		return;
+	}
+
+	region = _damage;
+	for (auto &rect : _moved) {
+		addRect(region, rect);
+	}
+	for (int i = 0; i < age - 1; i++) {
+		for (auto &rect : _damageHistory[i]) {
+			addRect(region, rect);
+		}
+	}
+}
+
+// Region of back buffer needing repaint, moves are only done in buffer
+// holding previous frame so moved pixels are already in place
+void Display::getRepaintRegion(std::vector<Rect> &region) {
+	U32 age = getBufferAge();
+
+	if (age == 1) {
+		region = _damage;
+		return;
+	}
+	getDamageRegion(age, region);
+}
+
+// Called by flip implementations once frame is queued
+void Display::submitDamage() {
+	for (auto &rect : _moved) {
+		addRect(_damage, rect);
+	}
+	_moved.clear();
+	for (int i = DISPLAY_DAMAGE_HISTORY - 1; i > 0; i--) {
+		_damageHistory[i].swap(_damageHistory[i - 1]);
+	}
+	_damageHistory[0].swap(_damage);
+	_damage.clear();
+}
+
+// Changed tiles of one tile row are joined into runs, run continuing one
+// of row above with same span extends it
+static void addTileRun(std::vector<Rect> &region, const Rect &run) {
+	if (RectIsEmpty(run))
+		return;
+
+	for (auto &rect : region) {
+		if (rect.x == run.x && rect.width == run.width && rect.y + rect.height == run.y) {
+			rect.height += run.height;
+			return;
+		}
+	}
+	region.push_back(run);
+}
+
+void Display::diffTiles(const Surface &frame, TileHashes &tiles, std::vector<Rect> &region) {
+	if (!_tileDiff)
+		return;
+
+	Rect screen = { 0, 0, (S32)frame.width, (S32)frame.height };
+	U32 columns = (frame.width + DISPLAY_TILE_WIDTH - 1) / DISPLAY_TILE_WIDTH;
+	U32 rows = (frame.height + DISPLAY_TILE_HEIGHT - 1) / DISPLAY_TILE_HEIGHT;
+	// without hashes every tile is copied, hashes are stored for next time
+	bool known = tiles.columns == columns && tiles.rows == rows && !tiles.hashes.empty();
+	if (!known) {
+		tiles.columns = columns;
+		tiles.rows = rows;
+		tiles.hashes.assign(columns * rows, 0);
+	}
+
+	_tileMarks.assign(columns * rows, 0);
+	for (auto &rect : region) {
+		Rect clipped = RectIntersect(rect, screen);
+		if (RectIsEmpty(clipped))
+			continue;
+		for (S32 row = clipped.y / DISPLAY_TILE_HEIGHT; row * DISPLAY_TILE_HEIGHT < clipped.y + clipped.height; row++) {
+			for (S32 column = clipped.x / DISPLAY_TILE_WIDTH; column * DISPLAY_TILE_WIDTH < clipped.x + clipped.width; column++)
+				_tileMarks[row * columns + column] = 1;
+		}
+	}
+
+	U32 hashed = 0, changed = 0;
+	region.clear();
+	for (U32 row = 0; row < rows; row++) {
+		Rect run = { 0, 0, 0, 0 };
+		for (U32 column = 0; column < columns; column++) {
+			U32 index = row * columns + column;
+			if (!_tileMarks[index]) {
+				addTileRun(region, run);
+				run = { 0, 0, 0, 0 };
+				continue;
+			}
+			Rect tile = RectIntersect({ (S32)column * DISPLAY_TILE_WIDTH, (S32)row * DISPLAY_TILE_HEIGHT,
+			                            DISPLAY_TILE_WIDTH, DISPLAY_TILE_HEIGHT }, screen);
+			U64 hash = BlitHash(frame, tile);
+			hashed++;
+			if (known && hash == tiles.hashes[index]) {
+				addTileRun(region, run);
+				run = { 0, 0, 0, 0 };
+				continue;
+			}
+			tiles.hashes[index] = hash;
+			changed++;
+			run = RectUnion(run, tile);
+		}
+		addTileRun(region, run);
+	}
+
+	_nextRecord.tilesHashed += hashed;
+	_nextRecord.tilesChanged += changed;
+}
+
+void Display::addDrawTimes(U32 clearUs, U32 textUs) {
+	_nextRecord.clear += clearUs;
+	_nextRecord.text += textUs;
+}
+
+U64 Display::recordSubmit(U64 flipTime) {
+	U64 sequence = _frameRecordCount.load(std::memory_order_relaxed);
+	FrameRecord &record = _frameRecords[sequence % DISPLAY_FRAME_RECORDS];
+
+	record = _nextRecord;
+	record.flipTime = flipTime;
+	record.submitTime = DisplayGetTimeUs();
+	record.submit = record.submitTime - flipTime;
+	_nextRecord = {};
+	_frameRecordCount.store(sequence + 1, std::memory_order_release);
+
+	return sequence;
+}
+
+// Frame was ready when flip() was called, any vblank after first one
+// following it is counted as missed
+void Display::recordPresent(U64 sequence, U64 vblankTime) {
+	if (sequence + DISPLAY_FRAME_RECORDS < _frameRecordCount.load(std::memory_order_relaxed))
+		return;
+
+	FrameRecord &record = _frameRecords[sequence % DISPLAY_FRAME_RECORDS];
+	record.complete = vblankTime > record.submitTime ? vblankTime - record.submitTime : 0;
+	record.missed = 0;
+	if (_refreshPeriod && vblankTime > record.flipTime)
+		record.missed = (vblankTime - record.flipTime) / _refreshPeriod;
+	record.presented = true;
+	if (record.missed) {
+		_missedVblanks += record.missed;
+		_missedFrames++;
+	}
+}
+
+static void logTiles(std::vector<U32> &changed, std::vector<U32> &hashed) {
+	U64 sumChanged = 0, sumHashed = 0;
+
+	for (int i = 0; i < changed.size(); i++) {
+		sumChanged += changed[i];
+		sumHashed += hashed[i];
+	}
+	if (sumHashed == 0)
+		return;
+	int p99 = (changed.size() * 99 + 99) / 100 - 1;
+	std::nth_element(changed.begin(), changed.begin() + p99, changed.end());
+	log->printf("  %-8s min %7u, avg %7.1f, p99 %7u changed, avg %.1f hashed\n", "tiles",
+	            *std::min_element(changed.begin(), changed.end()),
+	            (double)sumChanged / changed.size(), changed[p99], (double)sumHashed / hashed.size());
+}
+
+static void logPhase(const char *name, std::vector<U32> &values) {
+	if (values.empty())
+		return;
+
+	U64 sum = 0;
+	for (U32 value : values)
+		sum += value;
+	int p99 = (values.size() * 99 + 99) / 100 - 1;
+	std::nth_element(values.begin(), values.begin() + p99, values.end());
+	log->printf("  %-8s min %7.2f ms, avg %7.2f ms, p99 %7.2f ms\n", name,
+	            *std::min_element(values.begin(), values.end()) / 1000.0,
+	            sum / 1000.0 / values.size(), values[p99] / 1000.0);
+}
+
+void Display::logFrameStats() {
+	U64 count = _frameRecordCount.load(std::memory_order_acquire);
+	U64 first = count > DISPLAY_FRAME_RECORDS ? count - DISPLAY_FRAME_RECORDS : 0;
+	std::vector<U32> clear, text, submit, complete, tilesChanged, tilesHashed;
+	U64 lastPresented = 0;
+	int dropped = 0;
+
+	if (count == 0)
+		return;
+
+	for (U64 i = first; i < count; i++) {
+		const FrameRecord &record = _frameRecords[i % DISPLAY_FRAME_RECORDS];
+		clear.push_back(record.clear);
+		text.push_back(record.text);
+		submit.push_back(record.submit);
+		tilesChanged.push_back(record.tilesChanged);
+		tilesHashed.push_back(record.tilesHashed);
+		if (record.presented) {
+			complete.push_back(record.complete);
+			lastPresented = i + 1;
+		}
+	}
+	// frames older than last presented one were replaced before reaching screen
+	for (U64 i = first; i < lastPresented; i++) {
+		if (!_frameRecords[i % DISPLAY_FRAME_RECORDS].presented)
+			dropped++;
+	}
+
+	log->printf("Frame stats: last %llu of %llu frames, %llu vblanks missed by %llu frames, %d dropped\n",
+	            (unsigned long long)(count - first), (unsigned long long)count,
+	            (unsigned long long)_missedVblanks, (unsigned long long)_missedFrames, dropped);
+	logPhase("clear", clear);
+	logPhase("text", text);
+	logPhase("submit", submit);
+	logPhase("complete", complete);
+	logTiles(tilesChanged, tilesHashed);
 }
 
 Display *CreateDisplay(DISPLAY_TYPE displayType) {
@@ -40,7 +316,11 @@ Display *CreateDisplay(DISPLAY_TYPE displayType) {
 #else
 	case DISPLAY_DRM:
 		return new DisplayDrm();
+	case DISPLAY_DRM_ATOMIC:
+		return new DisplayDrmAtomic();
 #endif
+	case DISPLAY_HEADLESS:
+		return new DisplayHeadless();
 	default:
 		return nullptr;
 	}
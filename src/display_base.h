@@ -22,20 +22,97 @@
 #ifndef DISPLAY_BASE_H
 #define DISPLAY_BASE_H
 
+#include <vector>
+#include <atomic>
+
 #include "basetypes.h"
+#include "blit.h"
 
 typedef enum _DISPLAY_TYPE {
     DISPLAY_NONE,
     DISPLAY_DRM,
+    DISPLAY_DRM_ATOMIC,
+    DISPLAY_HEADLESS,
     DISPLAY_SDL2,
 } DISPLAY_TYPE;
 
+typedef enum _DISPLAY_SHADOW {
+    DISPLAY_SHADOW_AUTO,
+    DISPLAY_SHADOW_OFF,
+    DISPLAY_SHADOW_ON,
+} DISPLAY_SHADOW;
+
 namespace MpvGui {
 
+#define DISPLAY_DAMAGE_HISTORY   4
+#define DISPLAY_MAX_DAMAGE       8
+#define DISPLAY_FRAME_RECORDS    512
+#define DISPLAY_TILE_WIDTH       64
+#define DISPLAY_TILE_HEIGHT      16
+
+// Timings of one submitted frame, durations in us
+typedef struct {
+	U32                 clear;       // clearing repaint region
+	U32                 text;        // drawing items
+	U32                 submit;      // flip() call, includes waiting for earlier flip
+	U32                 complete;    // end of flip() until vblank showing frame
+	U32                 missed;      // vblanks passed since flip() call, beyond first
+	U32                 tilesHashed; // by tile diff, 0 when it is disabled
+	U32                 tilesChanged;
+	bool                presented;   // false while pending, or when replaced by newer frame
+	U64                 flipTime;    // CLOCK_MONOTONIC us, start of flip()
+	U64                 submitTime;  // CLOCK_MONOTONIC us, end of flip()
+} FrameRecord;
+
+// Hashes of frame tiles held by one destination of copies, like texture or
+// scanout buffer. Cleared when destination contents become unknown.
+typedef struct {
+	U32                 columns;
+	U32                 rows;
+	std::vector<U64>    hashes;
+} TileHashes;
+
+// CLOCK_MONOTONIC in us, same clock as DRM vblank timestamps
+U64 DisplayGetTimeUs();
+
 class Display {
 protected:
 
-	bool           _initialized;
+	bool                _initialized;
+	bool                _mailbox;
+	DISPLAY_SHADOW      _shadowMode;
+	PIXEL_FORMAT        _requestedFormat;
+	bool                _scaledRender;
+	bool                _tileDiff;
+	std::vector<U8>     _tileMarks;         // tiles touched by region being diffed
+
+	std::vector<Rect>   _damage;
+	std::vector<Rect>   _moved;             // changed by moving pixels, not repainted
+	std::vector<Rect>   _damageHistory[DISPLAY_DAMAGE_HISTORY];
+
+	// Ring written only by thread calling flip(), count is published after
+	// record is filled so it can be read without lock. Presentation fields
+	// are set later from same thread.
+	FrameRecord         _frameRecords[DISPLAY_FRAME_RECORDS];
+	std::atomic<U64>    _frameRecordCount;
+	FrameRecord         _nextRecord;        // times of frame being drawn
+	U32                 _refreshPeriod;     // us, 0 when unknown
+	U64                 _missedVblanks;
+	U64                 _missedFrames;
+
+	// Age of back buffer contents in frames, 0 when contents are undefined
+	virtual U32 getBufferAge() { return 0; }
+	void getDamageRegion(U32 age, std::vector<Rect> &region);
+	void submitDamage();
+	// Narrows region of frame to be copied to tiles differing from ones destination
+	// holds, updates hashes of destination. Leaves region as is unless enabled.
+	void diffTiles(const Surface &frame, TileHashes &tiles, std::vector<Rect> &region);
+
+	// Called by flip implementations, submit returns sequence of frame record
+	// which is passed to present once vblank showing frame is known
+	void setRefreshPeriod(U32 periodUs) { _refreshPeriod = periodUs; }
+	U64 recordSubmit(U64 flipTime);
+	void recordPresent(U64 sequence, U64 vblankTime);
 
 public:
 
@@ -44,12 +121,72 @@ public:
 
 	virtual STATUS init() = 0;
 	virtual STATUS deinit() = 0;
+	// Releases display to other process, backends without cheaper way reinitialize
+	virtual STATUS suspend() { return deinit(); }
+	virtual STATUS resume() { return init(); }
 	virtual void *getBufferPtr() = 0;
 	virtual U32 getBufferWidth() = 0;
 	virtual U32 getBufferHeight() = 0;
 	virtual U32 getBufferStride() = 0;
+	virtual PIXEL_FORMAT getBufferFormat() { return PIXEL_FORMAT_ARGB8888; }
+	// Back buffer is cached memory still holding last frame, reading it is cheap
+	virtual bool isBufferReadable() { return getBufferAge() == 1; }
 	virtual STATUS flip() = 0;
 	virtual void clear() = 0;
+
+	// Fd signalled when display has events to handle, -1 when it has none
+	virtual int getEventFd() { return -1; }
+	virtual STATUS handleEvents() { return S_OK; }
+
+	// Newer frame replaces one still waiting for vblank instead of being queued
+	void setMailbox(bool mailbox) { _mailbox = mailbox; }
+
+	// Composition into cached memory, copied to display on flip. Applies on next init.
+	void setShadowMode(DISPLAY_SHADOW mode) { _shadowMode = mode; }
+
+	// Format backend should use if it can, applies on next init
+	void setPixelFormat(PIXEL_FORMAT format) { _requestedFormat = format; }
+
+	// Frame tiles are hashed before copying to display and only changed ones are
+	// copied, for backends where damage is coarse. Applies to next flip.
+	void setTileDiff(bool enabled) { _tileDiff = enabled; }
+
+	// Buffers stay 1080p on larger outputs and are upscaled for scanout, applies on next init
+	void setScaledRender(bool scaled) { _scaledRender = scaled; }
+
+	// Small premultiplied ARGB8888 plane above frame, moving it needs no pixel
+	// writes. Fails on backends without spare plane.
+	virtual STATUS createOverlay(U32 width, U32 height) { return S_FAIL; }
+	virtual void destroyOverlay() {}
+	virtual void *getOverlayPtr() { return nullptr; }
+	virtual U32 getOverlayStride() { return 0; }
+	virtual void setOverlay(S32 x, S32 y, bool visible) {}
+
+	// Tall premultiplied ARGB8888 buffer on own plane between frame and overlay.
+	// Window shows part of it starting at offset line, scrolling needs no pixel writes.
+	// Pointer is to cached copy, drawn rects are passed to addScrollLayerDamage
+	// and reach plane with next commit.
+	virtual STATUS createScrollLayer(const Rect &window, U32 height) { return S_FAIL; }
+	virtual void destroyScrollLayer() {}
+	virtual void *getScrollLayerPtr() { return nullptr; }
+	virtual U32 getScrollLayerStride() { return 0; }
+	virtual void addScrollLayerDamage(const Rect &rect) {}
+	virtual void setScrollLayerOffset(U32 offset) {}
+
+	// Overlay and scroll layer changes are applied together with next flip,
+	// or by commitPlanes when no frame follows
+	virtual STATUS commitPlanes() { return S_FAIL; }
+
+	void addDamage(const Rect &rect);
+	// Rect whose pixels were moved within back buffer still holding last frame,
+	// it is copied to display but not repainted
+	void addMovedDamage(const Rect &rect);
+	void getRepaintRegion(std::vector<Rect> &region);
+
+	// Reported by renderer for frame submitted by next flip
+	void addDrawTimes(U32 clearUs, U32 textUs);
+	// Min, avg and p99 of each phase over recorded frames, plus missed vblanks
+	void logFrameStats();
 };
 
 Display *CreateDisplay(DISPLAY_TYPE displayType);
@@ -24,6 +24,7 @@
 #include "display_drm.h"
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -31,6 +32,7 @@
 #include <sys/mman.h>
 #include <drm.h>
 #include <poll.h>
+#include <algorithm>
 #include "display_base.h"
 #include "logs.h"
 
@@ -40,8 +42,12 @@ DisplayDrm::DisplayDrm() :
 		_fd(-1), _drmResources(nullptr),
 		_oldCrtc(nullptr), _drmPlaneResources(nullptr), _connectorId(-1),
 		_crtcId(-1), _planeId(-1), _width(0), _height(0),
-		_waitingForFlip(true),
-		_currentBuffer() {
+		_format(PIXEL_FORMAT_ARGB8888),
+		_currentBuffer(-1), _scanoutBuffer(0), _pendingBuffer(-1), _readyBuffer(-1),
+		_frameCount(0), _suspended(false), _planeScaling(false),
+		_shadowBuffer(nullptr), _shadowStride(0), _shadowSize(0), _shadowScale(1), _shadowValid(false),
+		_dirtyFbSupported(true) {
+	_overlay.planeId = _scrollLayer.planeId = -1;
 }
 
 DisplayDrm::~DisplayDrm() {
@@ -67,51 +73,508 @@ STATUS DisplayDrm::deinit() {
 	return S_OK;
 }
 
+// Hands display over to other process, device, buffers and probed
+// configuration are kept so resume does not need to start over
+STATUS DisplayDrm::suspend() {
+	if (!_initialized || _suspended)
+		return S_FAIL;
+
+	// frame waiting in mailbox is flipped too, so last rendered frame is on screen
+	waitForFlip();
+	_currentBuffer = -1;
+
+	// other process may want the planes, layers are shown again on resume
+	for (Layer *layer : { &_overlay, &_scrollLayer }) {
+		if (layer->visible)
+			drmModeSetPlane(_fd, layer->planeId, _crtcId, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	}
+
+	if (drmDropMaster(_fd) != 0)
+		log->printf("DisplayDrm::suspend(): Failed drop master: %s\n", strerror(errno));
+
+	_suspended = true;
+	return S_OK;
+}
+
+STATUS DisplayDrm::resume() {
+	if (!_initialized || !_suspended)
+		return S_FAIL;
+
+	if (drmSetMaster(_fd) != 0) {
+		log->printf("DisplayDrm::resume(): Failed set master: %s, reinitializing\n", strerror(errno));
+		internalDeinit();
+		return internalInit();
+	}
+	_suspended = false;
+
+	// other process may left CRTC in our mode, then flip is enough. Its
+	// framebuffer is usually released already, plane is then attached again.
+	bool sameMode = false, attached = false;
+	drmModeCrtcPtr crtc = drmModeGetCrtc(_fd, _crtcId);
+	if (crtc) {
+		sameMode = crtc->mode_valid &&
+		           crtc->mode.hdisplay == _modeInfo.hdisplay && crtc->mode.vdisplay == _modeInfo.vdisplay &&
+		           crtc->mode.htotal == _modeInfo.htotal && crtc->mode.vtotal == _modeInfo.vtotal &&
+		           crtc->mode.clock == _modeInfo.clock && crtc->mode.vrefresh == _modeInfo.vrefresh &&
+		           crtc->mode.flags == _modeInfo.flags;
+		attached = crtc->buffer_id != 0;
+		drmModeFreeCrtc(crtc);
+	}
+
+	_overlay.dirty = _overlay.planeId != -1;
+	_scrollLayer.dirty = _scrollLayer.planeId != -1;
+	if (!sameMode || (!attached && attachPrimary() == S_FAIL) || queueFlip(_scanoutBuffer) == S_FAIL) {
+		log->printf("DisplayDrm::resume(): Mode changed, setting mode again\n");
+		releaseModeset();
+		if (modeset() == S_FAIL) {
+			internalDeinit();
+			return internalInit();
+		}
+	}
+	commitPlanes();
+
+	return S_OK;
+}
+
 void *DisplayDrm::getBufferPtr() {
 	if (!_initialized)
 		return nullptr;
 
-	return _frameBuffers[_currentBuffer].ptr;
+	if (_shadowBuffer)
+		return _shadowBuffer;
+
+	return _frameBuffers[acquireBuffer()].ptr;
 }
 
 U32 DisplayDrm::getBufferWidth() {
 	if (!_initialized)
 		return 0;
 
-	return _frameBuffers[_currentBuffer].width;
+	return _width;
 }
 
 U32 DisplayDrm::getBufferHeight() {
 	if (!_initialized)
 		return 0;
 
-	return _frameBuffers[_currentBuffer].height;
+	return _height;
 }
 
 U32 DisplayDrm::getBufferStride() {
 	if (!_initialized)
 		return 0;
 
-	return _frameBuffers[_currentBuffer].stride;
+	if (_shadowBuffer)
+		return _shadowStride;
+
+	return _frameBuffers[0].stride;
+}
+
+PIXEL_FORMAT DisplayDrm::getBufferFormat() {
+	return _format;
+}
+
+// Dumb buffers are write-combined, reading them back is very slow
+bool DisplayDrm::isBufferReadable() {
+	return _shadowBuffer && getBufferAge() == 1;
+}
+
+U32 DisplayDrm::getBufferAge() {
+	if (!_initialized)
+		return 0;
+
+	// shadow buffer is single and persistent
+	if (_shadowBuffer)
+		return _shadowValid ? 1 : 0;
+
+	return getScanoutAge(acquireBuffer());
+}
+
+U32 DisplayDrm::getScanoutAge(int buffer) {
+	if (_frameBuffers[buffer].frame == 0)
+		return 0;
+
+	return _frameCount + 1 - _frameBuffers[buffer].frame;
+}
+
+// Picks buffer for rendering which is neither on screen nor waiting for flip
+int DisplayDrm::acquireBuffer() {
+	if (_currentBuffer != -1)
+		return _currentBuffer;
+
+	// completed flips may release buffers
+	struct pollfd fds[1] = { { .fd = _fd, .events = POLLIN } };
+	if (_pendingBuffer != -1 && poll(fds, 1, 0) > 0)
+		handleEvents();
+
+	for (int i = 0; i < NUM_FB; i++) {
+		if (i != _scanoutBuffer && i != _pendingBuffer && i != _readyBuffer) {
+			_currentBuffer = i;
+			return _currentBuffer;
+		}
+	}
+
+	// mailbox mode, frame still waiting for vblank is dropped and its buffer reused
+	_currentBuffer = _readyBuffer;
+	_readyBuffer = -1;
+
+	return _currentBuffer;
+}
+
+int DisplayDrm::getEventFd() {
+	if (!_initialized)
+		return -1;
+
+	return _fd;
+}
+
+STATUS DisplayDrm::handleEvents() {
+	if (!_initialized)
+		return S_FAIL;
+
+	if (drmHandleEvent(_fd, &_flipEvent) != 0) {
+		log->printf("DisplayDrm::handleEvents(): failed handle drm event: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+
+	return S_OK;
+}
+
+void DisplayDrm::pageFlipDone(U64 vblankTime) {
+	// late event of flip waitForFlip() already gave up on
+	if (_pendingBuffer == -1)
+		return;
+
+	// flips of buffer already on screen, for plane updates, carry no frame
+	if (_frameBuffers[_pendingBuffer].record) {
+		recordPresent(_frameBuffers[_pendingBuffer].record - 1, vblankTime);
+		_frameBuffers[_pendingBuffer].record = 0;
+	}
+
+	_scanoutBuffer = _pendingBuffer;
+	_pendingBuffer = -1;
+
+	if (_readyBuffer != -1) {
+		// frame stays ready and not presented, next flip() submits it again
+		if (queueFlip(_readyBuffer) == S_FAIL)
+			log->printf("DisplayDrm::pageFlipDone(): failed queue ready frame, retrying on next flip\n");
+		else
+			_readyBuffer = -1;
+	} else if (layersDirty()) {
+		applyLayers();
+	}
+}
+
+STATUS DisplayDrm::queueFlip(int buffer) {
+	if (layersDirty())
+		setLayerPlanes();
+
+	if (drmModePageFlip(_fd, _crtcId, _frameBuffers[buffer].fbId, DRM_MODE_PAGE_FLIP_EVENT, this) != 0) {
+		log->printf("DisplayDrm::queueFlip(): failed queue page flip: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+	_pendingBuffer = buffer;
+
+	return S_OK;
+}
+
+STATUS DisplayDrm::waitForFlip() {
+	while (_pendingBuffer != -1) {
+		struct pollfd fds[1] = { { .fd = _fd, .events = POLLIN } };
+		if (poll(fds, 1, 3000) <= 0) {
+			log->printf("DisplayDrm::waitForFlip(): page flip timeout\n");
+			// queued buffer may still reach screen, it is never reused as free one
+			_scanoutBuffer = _pendingBuffer;
+			_pendingBuffer = -1;
+			return S_FAIL;
+		}
+		if (handleEvents() == S_FAIL)
+			return S_FAIL;
+	}
+
+	return S_OK;
+}
+
+// Driver specific property, planes without it keep their default order
+static STATUS setPlaneZorder(int fd, uint32_t planeId, uint64_t zorder) {
+	drmModeObjectPropertiesPtr props;
+	STATUS status = S_OK;
+
+	props = drmModeObjectGetProperties(fd, planeId, DRM_MODE_OBJECT_PLANE);
+	if (!props) {
+		log->printf("setPlaneZorder(): Failed to find properties for plane!\n");
+		return S_FAIL;
+	}
+	for (int i = 0; i < props->count_props; i++) {
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop != nullptr && strcmp(prop->name, "zorder") == 0 && drm_property_type_is(prop, DRM_MODE_PROP_RANGE)) {
+			if (drmModeObjectSetProperty(fd, planeId, DRM_MODE_OBJECT_PLANE, prop->prop_id, zorder)) {
+				log->printf("setPlaneZorder(): Failed to set zorder property for plane!\n");
+				status = S_FAIL;
+			}
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return status;
+}
+
+// Takes first spare plane which accepts buffer shown at dst, primary plane has zorder 1
+STATUS DisplayDrm::createLayer(Layer &layer, const Rect &dst, U32 height, int zorder) {
+	if (!_initialized || layer.planeId != -1)
+		return S_FAIL;
+
+	layer = {};
+	layer.planeId = -1;
+	if (createBuffer(layer.buffer, dst.width, height, PIXEL_FORMAT_ARGB8888) == S_FAIL) {
+		destroyBuffer(layer.buffer);
+		return S_FAIL;
+	}
+	layer.dst = dst;
+	layer.zorder = zorder;
+
+	for (int planeId : _sparePlanes) {
+		if (planeId == _overlay.planeId || planeId == _scrollLayer.planeId)
+			continue;
+		layer.planeId = planeId;
+		if (testLayer(layer) == S_OK)
+			return S_OK;
+	}
+
+	log->printf("DisplayDrm::createLayer(): No plane usable for %dx%d layer\n", dst.width, height);
+	layer.planeId = -1;
+	destroyBuffer(layer.buffer);
+
+	return S_FAIL;
+}
+
+void DisplayDrm::destroyLayer(Layer &layer) {
+	if (layer.planeId == -1)
+		return;
+
+	if (layer.visible && !_suspended)
+		drmModeSetPlane(_fd, layer.planeId, _crtcId, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	destroyBuffer(layer.buffer);
+	destroyBuffer(layer.backBuffer);
+	free(layer.shadow);
+	layer = {};
+	layer.planeId = -1;
+}
+
+STATUS DisplayDrm::createOverlay(U32 width, U32 height) {
+	return createLayer(_overlay, { 0, 0, (S32)width, (S32)height }, height, 3);
+}
+
+void DisplayDrm::destroyOverlay() {
+	destroyLayer(_overlay);
+}
+
+void *DisplayDrm::getOverlayPtr() {
+	return _overlay.buffer.ptr;
+}
+
+U32 DisplayDrm::getOverlayStride() {
+	return _overlay.buffer.stride;
+}
+
+void DisplayDrm::setOverlay(S32 x, S32 y, bool visible) {
+	if (_overlay.planeId == -1)
+		return;
+
+	if (x == _overlay.dst.x && y == _overlay.dst.y && visible == _overlay.visible)
+		return;
+
+	_overlay.dst.x = x;
+	_overlay.dst.y = y;
+	_overlay.visible = visible;
+	_overlay.dirty = true;
+}
+
+// Shown from next commit, buffer starts cleared so nothing is visible before it is drawn
+STATUS DisplayDrm::createScrollLayer(const Rect &window, U32 height) {
+	if (createLayer(_scrollLayer, window, height, 2) == S_FAIL)
+		return S_FAIL;
+
+	Layer &layer = _scrollLayer;
+	layer.shadowStride = layer.buffer.width * 4;
+	if (createBuffer(layer.backBuffer, layer.buffer.width, height, PIXEL_FORMAT_ARGB8888) == S_FAIL ||
+	    posix_memalign((void **)&layer.shadow, 64, (size_t)layer.shadowStride * height) != 0) {
+		log->printf("DisplayDrm::createScrollLayer(): Failed create back buffer\n");
+		layer.shadow = nullptr;
+		destroyLayer(layer);
+		return S_FAIL;
+	}
+	memset(layer.shadow, 0, (size_t)layer.shadowStride * height);
+
+	_scrollLayer.visible = true;
+	_scrollLayer.dirty = true;
+
+	return S_OK;
+}
+
+void DisplayDrm::destroyScrollLayer() {
+	destroyLayer(_scrollLayer);
+}
+
+void *DisplayDrm::getScrollLayerPtr() {
+	return _scrollLayer.shadow;
+}
+
+U32 DisplayDrm::getScrollLayerStride() {
+	return _scrollLayer.shadowStride;
+}
+
+void DisplayDrm::addScrollLayerDamage(const Rect &rect) {
+	Layer &layer = _scrollLayer;
+	if (layer.planeId == -1)
+		return;
+
+	// row redrawn every frame, e.g. marquee, is listed once
+	for (auto *damage : { &layer.damage, &layer.backDamage }) {
+		auto same = [&](const Rect &other) { return RectEqual(other, rect); };
+		if (std::none_of(damage->begin(), damage->end(), same))
+			damage->push_back(rect);
+	}
+	layer.dirty = true;
+}
+
+void DisplayDrm::setScrollLayerOffset(U32 offset) {
+	if (_scrollLayer.planeId == -1)
+		return;
+
+	offset = MIN(offset, _scrollLayer.buffer.height - _scrollLayer.dst.height);
+	if (offset == _scrollLayer.srcY)
+		return;
+
+	_scrollLayer.srcY = offset;
+	_scrollLayer.dirty = true;
+}
+
+STATUS DisplayDrm::commitPlanes() {
+	if (_overlay.planeId == -1 && _scrollLayer.planeId == -1)
+		return S_FAIL;
+
+	if (!layersDirty() || _suspended)
+		return S_OK;
+
+	return applyLayers();
+}
+
+// Legacy calls have no test mode, cleared buffer is transparent so
+// showing it is not visible
+STATUS DisplayDrm::testLayer(Layer &layer) {
+	bool visible = layer.visible;
+
+	if (setPlaneZorder(_fd, layer.planeId, layer.zorder) == S_FAIL)
+		return S_FAIL;
+
+	layer.visible = true;
+	STATUS status = setLayerPlane(layer);
+	layer.visible = false;
+	if (setLayerPlane(layer) == S_FAIL)
+		status = S_FAIL;
+	layer.visible = visible;
+
+	return status;
+}
+
+STATUS DisplayDrm::applyLayers() {
+	return setLayerPlanes();
 }
 
+// Copies rects drawn since back buffer was shown, back buffer then takes place
+// of scanned out one. Called only when previous commit of layer has completed,
+// so back buffer is off screen. Returns true when buffers were swapped.
+bool DisplayDrm::updateLayerBuffer(Layer &layer) {
+	if (!layer.shadow || layer.backDamage.empty())
+		return false;
+
+	Surface src = { layer.shadow, layer.buffer.width, layer.buffer.height,
+	                layer.shadowStride, PIXEL_FORMAT_ARGB8888 };
+	Surface dst = { (U8 *)layer.backBuffer.ptr, layer.backBuffer.width, layer.backBuffer.height,
+	                layer.backBuffer.stride, PIXEL_FORMAT_ARGB8888 };
+	for (auto &rect : layer.backDamage) {
+		BlitCopy(dst, src, rect);
+	}
+	layer.backDamage.clear();
+	swapLayerBuffers(layer);
+
+	return true;
+}
+
+// Also reverts updateLayerBuffer() when commit showing back buffer failed
+void DisplayDrm::swapLayerBuffers(Layer &layer) {
+	std::swap(layer.buffer, layer.backBuffer);
+	std::swap(layer.damage, layer.backDamage);
+}
+
+// Legacy plane update, takes effect immediately. Layers are positioned
+// in render coordinates, scaled same way as primary plane.
+STATUS DisplayDrm::setLayerPlane(Layer &layer) {
+	U32 scale = _modeInfo.hdisplay / _width;
+	const Rect &dst = layer.dst;
+	bool swapped = false;
+	int ret;
+
+	// legacy plane update is blocking, previous buffer is off screen on return
+	if (layer.visible) {
+		swapped = updateLayerBuffer(layer);
+		ret = drmModeSetPlane(_fd, layer.planeId, _crtcId, layer.buffer.fbId, 0,
+		                      dst.x * scale, dst.y * scale, dst.width * scale, dst.height * scale,
+		                      0, layer.srcY << 16, dst.width << 16, dst.height << 16);
+	} else {
+		ret = drmModeSetPlane(_fd, layer.planeId, _crtcId, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	}
+	if (ret != 0) {
+		log->printf("DisplayDrm::setLayerPlane(): failed set plane: %s\n", strerror(errno));
+		if (swapped)
+			swapLayerBuffers(layer);
+		return S_FAIL;
+	}
+	layer.dirty = false;
+
+	return S_OK;
+}
+
+STATUS DisplayDrm::setLayerPlanes() {
+	STATUS status = S_OK;
+
+	for (Layer *layer : { &_scrollLayer, &_overlay }) {
+		if (layer->dirty && setLayerPlane(*layer) == S_FAIL)
+			status = S_FAIL;
+	}
+
+	return status;
+}
+
+static uint32_t drmFormat(PIXEL_FORMAT format) {
+	switch (format) {
+	case PIXEL_FORMAT_XRGB8888:
+		return DRM_FORMAT_XRGB8888;
+	case PIXEL_FORMAT_RGB565:
+		return DRM_FORMAT_RGB565;
+	case PIXEL_FORMAT_ARGB8888:
+	default:
+		return DRM_FORMAT_ARGB8888;
+	}
+}
+
+// Timestamp is CLOCK_MONOTONIC of vblank which started scanout of new buffer
 static void drm_page_flip(int fd, unsigned int msc, unsigned int sec,
                           unsigned int usec, void *data) {
 	DisplayDrm *display = (DisplayDrm *)data;
 
-	display->_waitingForFlip = false;
+	display->pageFlipDone((U64)sec * 1000000 + usec);
 }
 
 STATUS DisplayDrm::internalInit() {
 	drmDevice *devices[DRM_MAX_MINOR] = { 0 };
-	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
-	struct drm_mode_create_dumb creq = { 0 };
-	struct drm_mode_map_dumb mreq = { 0 };
 	drmModeConnectorPtr connector = nullptr;
-	drmModeObjectPropertiesPtr props;
 	int crtcIndex = -1;
 	int modeId = -1;
-	int ret;
+	std::vector<int> cursorPlanes;
+	bool shadow;
 
 	int card_count = drmGetDevices2(0, devices, SIZE_OF_ARRAY(devices));
 	for (int i = 0; i < card_count; i++) {
@@ -216,6 +679,7 @@ STATUS DisplayDrm::internalInit() {
 	}
 
 	_planeId = -1;
+	_sparePlanes.clear();
 	for (int i = 0; i < _drmPlaneResources->count_planes; i++) {
 		drmModePlane *plane = drmModeGetPlane(_fd, _drmPlaneResources->planes[i]);
 		if (plane == nullptr)
@@ -234,6 +698,10 @@ STATUS DisplayDrm::internalInit() {
 					uint64_t value = props->prop_values[i];
 					if (_planeId == -1 && value == DRM_PLANE_TYPE_PRIMARY) {
 						_planeId = plane->plane_id;
+					} else if (value == DRM_PLANE_TYPE_OVERLAY) {
+						_sparePlanes.push_back(plane->plane_id);
+					} else if (value == DRM_PLANE_TYPE_CURSOR) {
+						cursorPlanes.push_back(plane->plane_id);
 					}
 				}
 				drmModeFreeProperty(prop);
@@ -246,80 +714,70 @@ STATUS DisplayDrm::internalInit() {
 		log->printf("DisplayDrm::internalInit(): Failed to find plane!\n");
 		goto fail;
 	}
-
-	props = drmModeObjectGetProperties(_fd, _planeId, DRM_MODE_OBJECT_PLANE);
-	if (!props) {
-		log->printf("DisplayDrm::internalInit(): Failed to find properties for plane!\n");
-		goto fail;
-	}
-	for (int i = 0; i < props->count_props; i++) {
-		drmModePropertyPtr prop = drmModeGetProperty(_fd, props->props[i]);
-		if (prop != nullptr && strcmp(prop->name, "zorder") == 0 && drm_property_type_is(prop, DRM_MODE_PROP_RANGE)) {
-			if (drmModeObjectSetProperty(_fd, _planeId, DRM_MODE_OBJECT_PLANE, prop->prop_id, 1)) {
-				log->printf("DisplayDrm::internalInit(): Failed to set zorder property for plane!\n");
-				drmModeFreeProperty(prop);
-				drmModeFreeObjectProperties(props);
-				goto fail;
-			}
-		}
-		drmModeFreeProperty(prop);
-	}
-	drmModeFreeObjectProperties(props);
+	// cursor planes are often size limited, tried after overlay ones
+	_sparePlanes.insert(_sparePlanes.end(), cursorPlanes.begin(), cursorPlanes.end());
 
 	_width = _modeInfo.hdisplay;
 	_height = _modeInfo.vdisplay;
+	_format = _requestedFormat;
 
-	creq.height = _modeInfo.vdisplay;
-	creq.width = _modeInfo.hdisplay;
-	creq.bpp = 32;
-
-	for (int i = 0; i < NUM_FB; i++) {
-		if (drmIoctl(_fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0) {
-			log->printf("DisplayDrm::internalInit(): Cannot create dumb buffer: %s\n", strerror(errno));
-			return S_FAIL;
-		}
-		handles[0] = creq.handle;
-		pitches[0] = creq.pitch;
-
-		ret = drmModeAddFB2(_fd, _modeInfo.hdisplay, _modeInfo.vdisplay,
-		                    DRM_FORMAT_ARGB8888,
-		                    handles, pitches, offsets, &_frameBuffers[i].fbId, 0);
-		if (ret < 0) {
-			log->printf("DisplayDrm::internalInit(): failed add video buffer: %s\n", strerror(errno));
-			goto fail;
-		}
+	// text menu does not need 4K, plane scaler or pixel doubling restores full size
+	_planeScaling = _scaledRender && _width > 1920 && (_width & 1) == 0 && (_height & 1) == 0;
+	if (_planeScaling) {
+		_width /= 2;
+		_height /= 2;
+	}
 
-		mreq.handle = creq.handle;
-		if (drmIoctl(_fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq)) {
-		    log->printf("DisplayDrm::internalInit(): Cannot map dumb buffer: %s\n", strerror(errno));
-            goto fail;
-		}
-		_frameBuffers[i].ptr = mmap(nullptr, creq.size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, mreq.offset);
-		if (_frameBuffers[i].ptr == MAP_FAILED) {
-			log->printf("DisplayDrm::internalInit(): Cannot map dumb buffer: %s\n", strerror(errno));
-			goto fail;
-		}
+	if (createBuffers(_width, _height) == S_FAIL)
+		goto fail;
 
-		_frameBuffers[i].width = _modeInfo.hdisplay;
-		_frameBuffers[i].height = _modeInfo.vdisplay;
-		_frameBuffers[i].stride = creq.pitch;
-		_frameBuffers[i].size = creq.size;
+	_scanoutBuffer = 0;
+	_currentBuffer = _pendingBuffer = _readyBuffer = -1;
+	_suspended = false;
 
-		memset(_frameBuffers[i].ptr, 0, _frameBuffers[i].size);
+	_oldCrtc = drmModeGetCrtc(_fd, _crtcId);
+	if (modeset() == S_FAIL) {
+		if (!_planeScaling)
+			goto fail;
+		log->printf("DisplayDrm::internalInit(): Plane scaling not available, using pixel doubling\n");
+		_planeScaling = false;
+		destroyBuffers();
+		if (createBuffers(_modeInfo.hdisplay, _modeInfo.vdisplay) == S_FAIL || modeset() == S_FAIL)
+			goto fail;
 	}
 
-	_oldCrtc = drmModeGetCrtc(_fd, _crtcId);
-	ret = drmModeSetCrtc(_fd, _crtcId, _frameBuffers[0].fbId, 0, 0, &_connectorId, 1, &_modeInfo);
-	if (ret < 0) {
-		log->printf("DisplayDrm::internalInit(): failed set crtc: %s\n", strerror(errno));
-		goto fail;
+	// doubling needs render size buffer, it is kept cached like shadow one
+	_shadowScale = _frameBuffers[0].width / _width;
+	if (_shadowScale > 1) {
+		shadow = true;
+	} else if (_shadowMode == DISPLAY_SHADOW_AUTO) {
+		uint64_t preferShadow = 0;
+		shadow = drmGetCap(_fd, DRM_CAP_DUMB_PREFER_SHADOW, &preferShadow) == 0 && preferShadow;
+	} else {
+		shadow = _shadowMode == DISPLAY_SHADOW_ON;
 	}
+	if (shadow) {
+		_shadowStride = ALIGN2(_width * BlitGetBytesPerPixel(_format), 6);
+		_shadowSize = _shadowStride * _height;
+		if (posix_memalign((void **)&_shadowBuffer, 64, _shadowSize) != 0) {
+			log->printf("DisplayDrm::internalInit(): Failed alloc shadow buffer\n");
+			_shadowBuffer = nullptr;
+			goto fail;
+		}
+		memset(_shadowBuffer, 0, _shadowSize);
+		_shadowValid = false;
+	}
+	log->printf("DisplayDrm::internalInit(): Render %dx%d, output %dx%d, %s, shadow buffer %s\n",
+	            _width, _height, _modeInfo.hdisplay, _modeInfo.vdisplay,
+	            _planeScaling ? "plane scaling" : _shadowScale > 1 ? "pixel doubling" : "unscaled",
+	            shadow ? "enabled" : "disabled");
 
+	setRefreshPeriod(_modeInfo.vrefresh ? 1000000 / _modeInfo.vrefresh : 0);
 	_flipEvent.version = DRM_EVENT_CONTEXT_VERSION;
 	_flipEvent.page_flip_handler = &drm_page_flip;
 
-	_currentBuffer = 1;
-	_waitingForFlip = true;
+	_frameCount = 0;
+	_dirtyFbSupported = true;
 
 	_initialized = true;
 	return S_OK;
@@ -331,7 +789,133 @@ fail:
 	return S_FAIL;
 }
 
+STATUS DisplayDrm::createBuffer(FrameBuffer &buffer, U32 width, U32 height, PIXEL_FORMAT format) {
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	struct drm_mode_create_dumb creq = { 0 };
+	struct drm_mode_map_dumb mreq = { 0 };
+
+	creq.width = width;
+	creq.height = height;
+	creq.bpp = BlitGetBytesPerPixel(format) * 8;
+
+	if (drmIoctl(_fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0) {
+		log->printf("DisplayDrm::createBuffer(): Cannot create dumb buffer: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+	buffer.handle = creq.handle;
+	handles[0] = creq.handle;
+	pitches[0] = creq.pitch;
+
+	if (drmModeAddFB2(_fd, width, height, drmFormat(format),
+	                  handles, pitches, offsets, &buffer.fbId, 0) < 0) {
+		log->printf("DisplayDrm::createBuffer(): failed add video buffer: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+
+	mreq.handle = creq.handle;
+	if (drmIoctl(_fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq)) {
+		log->printf("DisplayDrm::createBuffer(): Cannot map dumb buffer: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+	buffer.ptr = mmap(nullptr, creq.size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, mreq.offset);
+	if (buffer.ptr == MAP_FAILED) {
+		buffer.ptr = nullptr;
+		log->printf("DisplayDrm::createBuffer(): Cannot map dumb buffer: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+
+	buffer.width = width;
+	buffer.height = height;
+	buffer.stride = creq.pitch;
+	buffer.size = creq.size;
+
+	memset(buffer.ptr, 0, buffer.size);
+
+	return S_OK;
+}
+
+void DisplayDrm::destroyBuffer(FrameBuffer &buffer) {
+	if (buffer.fbId) {
+		drmModeRmFB(_fd, buffer.fbId);
+		buffer.fbId = 0;
+	}
+	if (buffer.ptr) {
+		munmap(buffer.ptr, buffer.size);
+		buffer.ptr = nullptr;
+	}
+	if (buffer.handle > 0) {
+		struct drm_mode_destroy_dumb dreq = {
+			.handle = buffer.handle,
+		};
+		drmIoctl(_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+		buffer.handle = 0;
+	}
+	buffer = { 0 };
+}
+
+STATUS DisplayDrm::createBuffers(U32 width, U32 height) {
+	for (int i = 0; i < NUM_FB; i++) {
+		if (createBuffer(_frameBuffers[i], width, height, _format) == S_FAIL)
+			return S_FAIL;
+	}
+
+	return S_OK;
+}
+
+void DisplayDrm::destroyBuffers() {
+	for (int i = 0; i < NUM_FB; i++) {
+		destroyBuffer(_frameBuffers[i]);
+		_scanoutTiles[i].hashes.clear();
+	}
+}
+
+// Shows scanout buffer on primary plane of CRTC already in our mode
+STATUS DisplayDrm::attachPrimary() {
+	const FrameBuffer &buffer = _frameBuffers[_scanoutBuffer];
+
+	if (drmModeSetPlane(_fd, _planeId, _crtcId, buffer.fbId, 0, 0, 0, _modeInfo.hdisplay, _modeInfo.vdisplay,
+	                    0, 0, buffer.width << 16, buffer.height << 16) != 0) {
+		log->printf("DisplayDrm::attachPrimary(): failed set plane: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+
+	return S_OK;
+}
+
+// Legacy path, plane zorder and mode are set by separate calls
+STATUS DisplayDrm::modeset() {
+	// SetCrtc scans out framebuffer unscaled, it has to cover whole mode
+	if (_frameBuffers[_scanoutBuffer].width != _modeInfo.hdisplay ||
+	    _frameBuffers[_scanoutBuffer].height != _modeInfo.vdisplay) {
+		log->printf("DisplayDrm::modeset(): Legacy modeset cannot scale plane\n");
+		return S_FAIL;
+	}
+
+	if (setPlaneZorder(_fd, _planeId, 1) == S_FAIL)
+		return S_FAIL;
+
+	if (drmModeSetCrtc(_fd, _crtcId, _frameBuffers[_scanoutBuffer].fbId, 0, 0, &_connectorId, 1, &_modeInfo) < 0) {
+		log->printf("DisplayDrm::modeset(): failed set crtc: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+
+	return S_OK;
+}
+
 void DisplayDrm::internalDeinit() {
+	if (_suspended) {
+		drmSetMaster(_fd);
+		_suspended = false;
+	}
+
+	_readyBuffer = -1;
+	if (_pendingBuffer != -1)
+		waitForFlip();
+
+	destroyLayer(_overlay);
+	destroyLayer(_scrollLayer);
+	releaseModeset();
+
 	if (_oldCrtc) {
 		drmModeSetCrtc(_fd, _oldCrtc->crtc_id, _oldCrtc->buffer_id,
 		               _oldCrtc->x, _oldCrtc->y, &_connectorId, 1, &_oldCrtc->mode);
@@ -339,23 +923,11 @@ void DisplayDrm::internalDeinit() {
 		_oldCrtc = nullptr;
 	}
 
-	for (int i = 0; i < NUM_FB; i++) {
-		if (_frameBuffers[i].fbId) {
-			drmModeRmFB(_fd, _frameBuffers[i].fbId);
-			_frameBuffers[i].fbId = 0;
-		}
-		if (_frameBuffers[i].ptr) {
-			munmap(_frameBuffers[i].ptr, _frameBuffers[i].size);
-			_frameBuffers[i].ptr = nullptr;
-		}
-		if (_frameBuffers[i].handle > 0) {
-			struct drm_mode_destroy_dumb dreq = {
-				.handle = _frameBuffers[i].handle,
-			};
-			drmIoctl(_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-			_frameBuffers[i].handle = 0;
-		}
-		_frameBuffers[i] = { 0 };
+	destroyBuffers();
+
+	if (_shadowBuffer) {
+		free(_shadowBuffer);
+		_shadowBuffer = nullptr;
 	}
 
 	if (_drmPlaneResources != nullptr) {
@@ -381,26 +953,72 @@ STATUS DisplayDrm::flip() {
 	if (!_initialized)
 		return S_FAIL;
 
-	if (drmModePageFlip(_fd, _crtcId, _frameBuffers[_currentBuffer].fbId, DRM_MODE_PAGE_FLIP_EVENT, this) != 0) {
-		log->printf("DisplayDrm::flip(): failed queue page flip: %s\n", strerror(errno));
-		goto fail;
+	U64 flipTime = DisplayGetTimeUs();
+
+	// ready frame page flip handler failed to queue goes before this one,
+	// on failure damage and frame count stay as they were
+	if (_pendingBuffer == -1 && _readyBuffer != -1) {
+		if (queueFlip(_readyBuffer) == S_FAIL)
+			return S_FAIL;
+		_readyBuffer = -1;
 	}
 
-	while (_waitingForFlip) {
-		struct pollfd fds[1] = { { .fd = _fd, .events = POLLIN } };
-		poll(fds, 1, 3000);
-		if (fds[0].revents & POLLIN) {
-			if (drmHandleEvent(_fd, &_flipEvent) != 0) {
-				log->printf("DisplayDrm::flip(): failed handle drm event: %s\n", strerror(errno));
-				goto fail;
-			}
+	// damage missed by scanout buffer, same as repaint region unless shadowed
+	U32 age = getScanoutAge(acquireBuffer());
+	getDamageRegion(age, _dirtyRegion);
+	if (_shadowBuffer) {
+		FrameBuffer &buffer = _frameBuffers[_currentBuffer];
+		Surface dst = { (U8 *)buffer.ptr, buffer.width, buffer.height, buffer.stride, _format };
+		Surface src = { _shadowBuffer, _width, _height, _shadowStride, _format };
+		// scanout buffer never presented holds nothing known
+		if (age == 0)
+			_scanoutTiles[_currentBuffer].hashes.clear();
+		diffTiles(src, _scanoutTiles[_currentBuffer], _dirtyRegion);
+		for (auto &rect : _dirtyRegion) {
+			if (_shadowScale > 1)
+				BlitScale2x(dst, src, rect);
+			else
+				BlitCopy(dst, src, rect);
+		}
+		_shadowValid = true;
+	}
+	submitDamage();
+
+	if (_dirtyFbSupported && !_dirtyRegion.empty()) {
+		drmModeClip clips[DISPLAY_MAX_DAMAGE * (DISPLAY_DAMAGE_HISTORY + 1)];
+		int numClips = MIN(_dirtyRegion.size(), SIZE_OF_ARRAY(clips));
+		for (int i = 0; i < numClips; i++) {
+			Rect rect = _dirtyRegion[i];
+			// tile diff may give more rects than clips, last clip covers the rest
+			for (int j = numClips; i == numClips - 1 && j < _dirtyRegion.size(); j++)
+				rect = RectUnion(rect, _dirtyRegion[j]);
+			clips[i].x1 = rect.x * _shadowScale;
+			clips[i].y1 = rect.y * _shadowScale;
+			clips[i].x2 = (rect.x + rect.width) * _shadowScale;
+			clips[i].y2 = (rect.y + rect.height) * _shadowScale;
+		}
+		// drivers scanning out continuously do not implement it
+		int ret = drmModeDirtyFB(_fd, _frameBuffers[_currentBuffer].fbId, clips, numClips);
+		if (ret == -ENOSYS || ret == -EINVAL || ret == -EOPNOTSUPP) {
+			_dirtyFbSupported = false;
+		} else if (ret != 0) {
+			log->printf("DisplayDrm::flip(): failed dirty fb: %s\n", strerror(-ret));
 		}
 	}
 
-	if (++_currentBuffer >= NUM_FB)
-		_currentBuffer = 0;
-
-	_waitingForFlip = true;
+	_frameBuffers[_currentBuffer].frame = ++_frameCount;
+	if (_pendingBuffer == -1) {
+		if (queueFlip(_currentBuffer) == S_FAIL)
+			goto fail;
+	} else if (_mailbox) {
+		// submitted from page flip handler, or replaced by newer frame
+		_readyBuffer = _currentBuffer;
+	} else {
+		if (waitForFlip() == S_FAIL || queueFlip(_currentBuffer) == S_FAIL)
+			goto fail;
+	}
+	_frameBuffers[_currentBuffer].record = recordSubmit(flipTime) + 1;
+	_currentBuffer = -1;
 
 	return S_OK;
 
@@ -410,7 +1028,13 @@ fail:
 }
 
 void DisplayDrm::clear() {
-	memset(_frameBuffers[_currentBuffer].ptr, 0, _frameBuffers[_currentBuffer].size);
+	if (_shadowBuffer) {
+		memset(_shadowBuffer, 0, _shadowSize);
+		return;
+	}
+
+	int buffer = acquireBuffer();
+	memset(_frameBuffers[buffer].ptr, 0, _frameBuffers[buffer].size);
 }
 
 } // namespace
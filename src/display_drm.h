@@ -33,10 +33,10 @@
 
 namespace MpvGui {
 
-#define NUM_FB   2
+#define NUM_FB   3
 
 class DisplayDrm : public Display {
-private:
+protected:
 
 	typedef struct {
 		uint32_t        handle;
@@ -46,8 +46,29 @@ private:
 		U32             width;
 		U32             height;
 		U32             size;
+		U64             frame;     // frame number when presented, 0 when never
+		U64             record;    // frame record sequence + 1, 0 when not waiting for vblank
 	} FrameBuffer;
 
+	// Buffer on spare plane above primary one. Scroll layer is drawn into
+	// cached shadow, damage is copied into back buffer which then replaces
+	// scanned out one, so rows are never written while shown.
+	typedef struct {
+		int             planeId;   // -1 when layer is not created
+		FrameBuffer     buffer;
+		FrameBuffer     backBuffer; // unused without shadow
+		U8              *shadow;
+		U32             shadowStride;
+		std::vector<Rect> damage;  // shadow rects not yet copied into buffer
+		std::vector<Rect> backDamage;
+		Rect            dst;       // on screen, in render coordinates
+		U32             srcY;      // first buffer line shown
+		U32             zorder;    // above primary plane, which has 1
+		uint32_t        zorderProp; // atomic zorder property, 0 when plane has none
+		bool            visible;
+		bool            dirty;     // state not yet sent to plane
+	} Layer;
+
 	int                         _fd;
 	drmModeResPtr               _drmResources;
 	drmModePlaneResPtr          _drmPlaneResources;
@@ -58,33 +79,96 @@ private:
 	uint32_t                    _crtcId;
 	int                         _planeId;
 
-	U32                         _width;
+	U32                         _width;           // render size, half of mode size when scaled
 	U32                         _height;
+	PIXEL_FORMAT                _format;
 
 	FrameBuffer                 _frameBuffers[NUM_FB]{};
 
-	int                         _currentBuffer;
+	int                         _currentBuffer;   // being rendered, -1 until acquired
+	int                         _scanoutBuffer;   // on screen
+	int                         _pendingBuffer;   // page flip queued, -1 when none
+	int                         _readyBuffer;     // waiting for pending flip to finish, -1 when none
+	U64                         _frameCount;
+	bool                        _suspended;
 
-public:
+	bool                        _planeScaling;    // plane upscales render size buffers
 
-	bool                        _waitingForFlip;
+	U8                          *_shadowBuffer;
+	U32                         _shadowStride;
+	U32                         _shadowSize;
+	U32                         _shadowScale;     // 2 when shadow is pixel doubled into scanout
+	bool                        _shadowValid;
+
+	std::vector<int>            _sparePlanes;     // overlay planes, then cursor ones
+	Layer                       _overlay{};
+	Layer                       _scrollLayer{};
+
+	bool                        _dirtyFbSupported;
+	std::vector<Rect>           _dirtyRegion;
+	TileHashes                  _scanoutTiles[NUM_FB];   // of shadow copies, per frame buffer
+
+public:
 
 	DisplayDrm();
 	~DisplayDrm();
 
 	STATUS init();
 	STATUS deinit();
+	STATUS suspend();
+	STATUS resume();
 	void *getBufferPtr();
 	U32 getBufferWidth();
 	U32 getBufferHeight();
 	U32 getBufferStride();
+	PIXEL_FORMAT getBufferFormat();
+	bool isBufferReadable();
 	STATUS flip();
 	void clear();
+	int getEventFd();
+	STATUS handleEvents();
+	void pageFlipDone(U64 vblankTime);
+	STATUS createOverlay(U32 width, U32 height);
+	void destroyOverlay();
+	void *getOverlayPtr();
+	U32 getOverlayStride();
+	void setOverlay(S32 x, S32 y, bool visible);
+	STATUS createScrollLayer(const Rect &window, U32 height);
+	void destroyScrollLayer();
+	void *getScrollLayerPtr();
+	U32 getScrollLayerStride();
+	void addScrollLayerDamage(const Rect &rect);
+	void setScrollLayerOffset(U32 offset);
+	STATUS commitPlanes();
+
+protected:
+
+	U32 getBufferAge();
+	U32 getScanoutAge(int buffer);
+	virtual STATUS modeset();
+	virtual void releaseModeset() {}
+	virtual STATUS attachPrimary();
+	virtual STATUS queueFlip(int buffer);
+	bool layersDirty() { return _overlay.dirty || _scrollLayer.dirty; }
+	STATUS createLayer(Layer &layer, const Rect &dst, U32 height, int zorder);
+	void destroyLayer(Layer &layer);
+	virtual STATUS testLayer(Layer &layer);
+	virtual STATUS applyLayers();
+	bool updateLayerBuffer(Layer &layer);
+	void swapLayerBuffers(Layer &layer);
+	STATUS setLayerPlane(Layer &layer);
+	STATUS setLayerPlanes();
 
 private:
 
 	STATUS internalInit();
 	void internalDeinit();
+	STATUS createBuffer(FrameBuffer &buffer, U32 width, U32 height, PIXEL_FORMAT format);
+	void destroyBuffer(FrameBuffer &buffer);
+	STATUS createBuffers(U32 width, U32 height);
+	void destroyBuffers();
+	int acquireBuffer();
+	STATUS waitForFlip();
 };
 
 } // namespace
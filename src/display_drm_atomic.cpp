@@ -0,0 +1,308 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#if !defined(BUILD_SDL2)
+
+#include "display_drm_atomic.h"
+
+#include <errno.h>
+#include <string.h>
+#include "logs.h"
+
+namespace MpvGui {
+
+DisplayDrmAtomic::DisplayDrmAtomic() :
+		_atomic(false), _props(), _modeBlobId(0) {
+}
+
+DisplayDrmAtomic::~DisplayDrmAtomic() {
+	// release atomic state while derived object still exists
+	deinit();
+}
+
+static uint32_t getPropertyId(int fd, uint32_t objectId, uint32_t objectType, const char *name) {
+	uint32_t propId = 0;
+
+	drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, objectId, objectType);
+	if (!props)
+		return 0;
+	for (int i = 0; i < props->count_props && propId == 0; i++) {
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop != nullptr && strcmp(prop->name, name) == 0)
+			propId = prop->prop_id;
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return propId;
+}
+
+// Generic zpos or driver specific zorder, immutable order cannot be set
+static uint32_t getZorderPropertyId(int fd, uint32_t planeId) {
+	uint32_t propId = 0;
+
+	drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, planeId, DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return 0;
+	for (int i = 0; i < props->count_props && propId == 0; i++) {
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop != nullptr && (strcmp(prop->name, "zpos") == 0 || strcmp(prop->name, "zorder") == 0) &&
+		    !(prop->flags & DRM_MODE_PROP_IMMUTABLE))
+			propId = prop->prop_id;
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return propId;
+}
+
+// Property ids are resolved once, commits only reference cached ids
+STATUS DisplayDrmAtomic::lookupProperties() {
+	_props.connectorCrtcId = getPropertyId(_fd, _connectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+	_props.crtcModeId = getPropertyId(_fd, _crtcId, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+	_props.crtcActive = getPropertyId(_fd, _crtcId, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+	_props.planeFbId = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "FB_ID");
+	_props.planeCrtcId = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+	_props.planeSrcX = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "SRC_X");
+	_props.planeSrcY = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+	_props.planeSrcW = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "SRC_W");
+	_props.planeSrcH = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "SRC_H");
+	_props.planeCrtcX = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+	_props.planeCrtcY = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+	_props.planeCrtcW = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+	_props.planeCrtcH = getPropertyId(_fd, _planeId, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+	_props.planeZorder = getZorderPropertyId(_fd, _planeId);
+
+	if (!_props.connectorCrtcId || !_props.crtcModeId || !_props.crtcActive ||
+	    !_props.planeFbId || !_props.planeCrtcId ||
+	    !_props.planeSrcX || !_props.planeSrcY || !_props.planeSrcW || !_props.planeSrcH ||
+	    !_props.planeCrtcX || !_props.planeCrtcY || !_props.planeCrtcW || !_props.planeCrtcH) {
+		log->printf("DisplayDrmAtomic::lookupProperties(): Missing atomic properties!\n");
+		_props = {};
+		return S_FAIL;
+	}
+
+	return S_OK;
+}
+
+// Source is in pixels, converted to 16.16 fixed point as required by KMS
+void DisplayDrmAtomic::addPlaneProperties(drmModeAtomicReqPtr req, uint32_t planeId, uint32_t fbId,
+                                          const Rect &src, const Rect &dst) {
+	drmModeAtomicAddProperty(req, planeId, _props.planeFbId, fbId);
+	drmModeAtomicAddProperty(req, planeId, _props.planeCrtcId, _crtcId);
+	drmModeAtomicAddProperty(req, planeId, _props.planeSrcX, (uint64_t)src.x << 16);
+	drmModeAtomicAddProperty(req, planeId, _props.planeSrcY, (uint64_t)src.y << 16);
+	drmModeAtomicAddProperty(req, planeId, _props.planeSrcW, (uint64_t)src.width << 16);
+	drmModeAtomicAddProperty(req, planeId, _props.planeSrcH, (uint64_t)src.height << 16);
+	drmModeAtomicAddProperty(req, planeId, _props.planeCrtcX, dst.x);
+	drmModeAtomicAddProperty(req, planeId, _props.planeCrtcY, dst.y);
+	drmModeAtomicAddProperty(req, planeId, _props.planeCrtcW, dst.width);
+	drmModeAtomicAddProperty(req, planeId, _props.planeCrtcH, dst.height);
+}
+
+// Layer state goes into same commit as primary flip, so both change on same vblank.
+// Caller clears dirty flag once commit succeeded.
+void DisplayDrmAtomic::addLayerProperties(drmModeAtomicReqPtr req, Layer &layer) {
+	if (layer.visible) {
+		S32 scale = _modeInfo.hdisplay / _width;
+		Rect src = { 0, (S32)layer.srcY, layer.dst.width, layer.dst.height };
+		Rect dst = { layer.dst.x * scale, layer.dst.y * scale, layer.dst.width * scale, layer.dst.height * scale };
+		addPlaneProperties(req, layer.planeId, layer.buffer.fbId, src, dst);
+		if (layer.zorderProp)
+			drmModeAtomicAddProperty(req, layer.planeId, layer.zorderProp, layer.zorder);
+	} else {
+		drmModeAtomicAddProperty(req, layer.planeId, _props.planeFbId, 0);
+		drmModeAtomicAddProperty(req, layer.planeId, _props.planeCrtcId, 0);
+	}
+}
+
+// Validates request with TEST_ONLY before committing it
+STATUS DisplayDrmAtomic::commit(drmModeAtomicReqPtr req, uint32_t flags) {
+	if (drmModeAtomicCommit(_fd, req, flags | DRM_MODE_ATOMIC_TEST_ONLY, nullptr) != 0) {
+		log->printf("DisplayDrmAtomic::commit(): Test commit failed: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+	if (drmModeAtomicCommit(_fd, req, flags, this) != 0) {
+		log->printf("DisplayDrmAtomic::commit(): Commit failed: %s\n", strerror(errno));
+		return S_FAIL;
+	}
+
+	return S_OK;
+}
+
+STATUS DisplayDrmAtomic::modeset() {
+	drmModeAtomicReqPtr req = nullptr;
+	Rect screen = { 0, 0, _modeInfo.hdisplay, _modeInfo.vdisplay };
+	FrameBuffer &buffer = _frameBuffers[_scanoutBuffer];
+
+	_atomic = false;
+	if (drmSetClientCap(_fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+		log->printf("DisplayDrmAtomic::modeset(): Atomic not supported, using legacy modeset\n");
+		return DisplayDrm::modeset();
+	}
+	// ids stay valid while device is open, resume reuses them
+	if (_props.planeFbId == 0 && lookupProperties() == S_FAIL)
+		goto fallback;
+
+	if (drmModeCreatePropertyBlob(_fd, &_modeInfo, sizeof(_modeInfo), &_modeBlobId) != 0) {
+		log->printf("DisplayDrmAtomic::modeset(): Failed create mode blob: %s\n", strerror(errno));
+		goto fallback;
+	}
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		goto fallback;
+	drmModeAtomicAddProperty(req, _connectorId, _props.connectorCrtcId, _crtcId);
+	drmModeAtomicAddProperty(req, _crtcId, _props.crtcModeId, _modeBlobId);
+	drmModeAtomicAddProperty(req, _crtcId, _props.crtcActive, 1);
+	// smaller buffer is upscaled by plane, test commit rejects it where scaler is missing
+	addPlaneProperties(req, _planeId, buffer.fbId, { 0, 0, (S32)buffer.width, (S32)buffer.height }, screen);
+	if (_props.planeZorder)
+		drmModeAtomicAddProperty(req, _planeId, _props.planeZorder, 1);
+	if (commit(req, DRM_MODE_ATOMIC_ALLOW_MODESET) == S_FAIL)
+		goto fallback;
+	drmModeAtomicFree(req);
+
+	_atomic = true;
+	log->printf("DisplayDrmAtomic::modeset(): Using atomic modesetting\n");
+
+	return S_OK;
+
+fallback:
+
+	if (req)
+		drmModeAtomicFree(req);
+	releaseModeset();
+	// dropping atomic also drops universal planes, legacy calls on primary plane need them
+	drmSetClientCap(_fd, DRM_CLIENT_CAP_ATOMIC, 0);
+	if (drmSetClientCap(_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1)) {
+		log->printf("DisplayDrmAtomic::modeset(): Failed to set universal planes capability!\n");
+		return S_FAIL;
+	}
+	log->printf("DisplayDrmAtomic::modeset(): Falling back to legacy modeset\n");
+
+	return DisplayDrm::modeset();
+}
+
+// Plane state without mode, CRTC keeps running
+STATUS DisplayDrmAtomic::attachPrimary() {
+	if (!_atomic)
+		return DisplayDrm::attachPrimary();
+
+	FrameBuffer &buffer = _frameBuffers[_scanoutBuffer];
+	drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+	if (!req)
+		return S_FAIL;
+	addPlaneProperties(req, _planeId, buffer.fbId, { 0, 0, (S32)buffer.width, (S32)buffer.height },
+	                   { 0, 0, _modeInfo.hdisplay, _modeInfo.vdisplay });
+	STATUS status = commit(req, 0);
+	drmModeAtomicFree(req);
+
+	return status;
+}
+
+void DisplayDrmAtomic::releaseModeset() {
+	if (_modeBlobId) {
+		drmModeDestroyPropertyBlob(_fd, _modeBlobId);
+		_modeBlobId = 0;
+	}
+	_atomic = false;
+}
+
+// Test commit only, nothing is shown. Position changes within screen are
+// then not expected to fail in the middle of flip. Zorder is part of the
+// test and is sent again with every commit showing layer.
+STATUS DisplayDrmAtomic::testLayer(Layer &layer) {
+	if (!_atomic)
+		return DisplayDrm::testLayer(layer);
+
+	layer.zorderProp = getZorderPropertyId(_fd, layer.planeId);
+	drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+	if (!req)
+		return S_FAIL;
+	Layer test = layer;
+	test.visible = true;
+	addLayerProperties(req, test);
+	int ret = drmModeAtomicCommit(_fd, req, DRM_MODE_ATOMIC_TEST_ONLY, nullptr);
+	drmModeAtomicFree(req);
+	if (ret != 0) {
+		log->printf("DisplayDrmAtomic::testLayer(): Plane %d rejected: %s\n", layer.planeId, strerror(errno));
+		return S_FAIL;
+	}
+
+	return S_OK;
+}
+
+// Commits on CRTC are serialized, while flip is pending layer changes
+// wait for it and are sent from page flip handler
+STATUS DisplayDrmAtomic::applyLayers() {
+	if (!_atomic)
+		return DisplayDrm::applyLayers();
+
+	if (_pendingBuffer != -1)
+		return S_OK;
+
+	// flip to buffer already on screen only updates layers
+	return queueFlip(_scanoutBuffer);
+}
+
+// Configuration was validated at modeset, flips only swap framebuffer
+STATUS DisplayDrmAtomic::queueFlip(int buffer) {
+	if (!_atomic)
+		return DisplayDrm::queueFlip(buffer);
+
+	drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+	if (!req)
+		return S_FAIL;
+	drmModeAtomicAddProperty(req, _planeId, _props.planeFbId, _frameBuffers[buffer].fbId);
+	// failed commit leaves layers dirty, their state is sent with next one.
+	// No commit is pending here, so layer back buffers are off screen.
+	bool sent[2] = {}, swapped[2] = {};
+	Layer *layers[2] = { &_scrollLayer, &_overlay };
+	for (int i = 0; i < 2; i++) {
+		sent[i] = layers[i]->dirty;
+		if (sent[i]) {
+			swapped[i] = updateLayerBuffer(*layers[i]);
+			addLayerProperties(req, *layers[i]);
+		}
+	}
+	int ret = drmModeAtomicCommit(_fd, req, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, this);
+	drmModeAtomicFree(req);
+	if (ret != 0) {
+		log->printf("DisplayDrmAtomic::queueFlip(): failed commit flip: %s\n", strerror(errno));
+		for (int i = 0; i < 2; i++) {
+			if (swapped[i])
+				swapLayerBuffers(*layers[i]);
+		}
+		return S_FAIL;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (sent[i])
+			layers[i]->dirty = false;
+	}
+	_pendingBuffer = buffer;
+
+	return S_OK;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DISPLAY_DRM_ATOMIC_H
+#define DISPLAY_DRM_ATOMIC_H
+
+#if !defined(BUILD_SDL2)
+
+#include "display_drm.h"
+
+namespace MpvGui {
+
+// Same buffers and flip handling as DisplayDrm, but mode, planes and flips
+// are submitted as atomic commits. Falls back to legacy calls if driver
+// does not support atomic modesetting.
+class DisplayDrmAtomic : public DisplayDrm {
+protected:
+
+	typedef struct {
+		uint32_t        connectorCrtcId;
+		uint32_t        crtcModeId;
+		uint32_t        crtcActive;
+		uint32_t        planeFbId;
+		uint32_t        planeCrtcId;
+		uint32_t        planeSrcX;
+		uint32_t        planeSrcY;
+		uint32_t        planeSrcW;
+		uint32_t        planeSrcH;
+		uint32_t        planeCrtcX;
+		uint32_t        planeCrtcY;
+		uint32_t        planeCrtcW;
+		uint32_t        planeCrtcH;
+		uint32_t        planeZorder;   // 0 when plane has no zorder
+	} AtomicProps;
+
+	bool                        _atomic;
+	AtomicProps                 _props;
+	uint32_t                    _modeBlobId;
+
+public:
+
+	DisplayDrmAtomic();
+	~DisplayDrmAtomic();
+
+protected:
+
+	STATUS modeset();
+	void releaseModeset();
+	STATUS attachPrimary();
+	STATUS queueFlip(int buffer);
+	STATUS testLayer(Layer &layer);
+	STATUS applyLayers();
+
+	STATUS lookupProperties();
+	void addPlaneProperties(drmModeAtomicReqPtr req, uint32_t planeId, uint32_t fbId,
+	                        const Rect &src, const Rect &dst);
+	void addLayerProperties(drmModeAtomicReqPtr req, Layer &layer);
+	STATUS commit(drmModeAtomicReqPtr req, uint32_t flags);
+};
+
+} // namespace
+
+#endif
+
+#endif
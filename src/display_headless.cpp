@@ -0,0 +1,236 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "display_headless.h"
+#include "logs.h"
+
+namespace MpvGui {
+
+#define DEFAULT_WIDTH         1920
+#define DEFAULT_HEIGHT        1080
+#define DEFAULT_REFRESH_RATE  60
+
+DisplayHeadless::DisplayHeadless() :
+		_width(DEFAULT_WIDTH), _height(DEFAULT_HEIGHT), _stride(DEFAULT_WIDTH * 4),
+		_refreshRate(DEFAULT_REFRESH_RATE), _buffer(nullptr), _bufferValid(false),
+		_vblankStart(0), _frameCount(0), _damageBytes(0), _flipTime(0), _flipTimeMax(0),
+		_dumpFormat(HEADLESS_DUMP_NONE) {
+}
+
+DisplayHeadless::~DisplayHeadless() {
+	deinit();
+}
+
+// Refresh rate 0 disables vblank pacing, takes effect on next init
+void DisplayHeadless::setMode(U32 width, U32 height, U32 refreshRate) {
+	_width = width;
+	_height = height;
+	_refreshRate = refreshRate;
+}
+
+// Pattern comes from command line, it is used as format only when its
+// single conversion takes frame number
+static bool isDumpPatternValid(const char *pattern) {
+	int conversions = 0;
+
+	for (const char *p = pattern; *p; p++) {
+		if (*p != '%')
+			continue;
+		if (p[1] == '%') {
+			p++;
+			continue;
+		}
+		while (p[1] >= '0' && p[1] <= '9')
+			p++;
+		if (p[1] != 'd')
+			return false;
+		p++;
+		conversions++;
+	}
+
+	return conversions == 1;
+}
+
+void DisplayHeadless::setDump(const char *pattern, HEADLESS_DUMP format) {
+	if (pattern && !isDumpPatternValid(pattern)) {
+		log->printf("DisplayHeadless::setDump(): Pattern %s needs one %%d for frame number, dump disabled\n", pattern);
+		pattern = nullptr;
+	}
+	_dumpPattern = pattern ? pattern : "";
+	_dumpFormat = pattern ? format : HEADLESS_DUMP_NONE;
+}
+
+STATUS DisplayHeadless::init() {
+	if (_initialized)
+		return S_FAIL;
+
+	_stride = _width * 4;
+	_buffer = (U8 *)calloc(_stride, _height);
+	if (!_buffer) {
+		log->printf("DisplayHeadless::init(): Failed alloc buffer %ux%u\n", _width, _height);
+		return S_FAIL;
+	}
+	_bufferValid = false;
+	_vblankStart = DisplayGetTimeUs();
+	_frameCount = _damageBytes = _flipTime = _flipTimeMax = 0;
+	setRefreshPeriod(_refreshRate ? 1000000 / _refreshRate : 0);
+
+	log->printf("DisplayHeadless::init(): %ux%u at %u Hz\n", _width, _height, _refreshRate);
+
+	_initialized = true;
+	return S_OK;
+}
+
+STATUS DisplayHeadless::deinit() {
+	if (!_initialized)
+		return S_FAIL;
+
+	logStats();
+	free(_buffer);
+	_buffer = nullptr;
+
+	_initialized = false;
+	return S_OK;
+}
+
+void *DisplayHeadless::getBufferPtr() {
+	if (!_initialized)
+		return nullptr;
+
+	return _buffer;
+}
+
+U32 DisplayHeadless::getBufferWidth() {
+	if (!_initialized)
+		return 0;
+
+	return _width;
+}
+
+U32 DisplayHeadless::getBufferHeight() {
+	if (!_initialized)
+		return 0;
+
+	return _height;
+}
+
+U32 DisplayHeadless::getBufferStride() {
+	if (!_initialized)
+		return 0;
+
+	return _stride;
+}
+
+U32 DisplayHeadless::getBufferAge() {
+	return _bufferValid ? 1 : 0;
+}
+
+void DisplayHeadless::dumpFrame() {
+	char path[1024];
+
+	snprintf(path, sizeof(path), _dumpPattern.c_str(), (int)_frameCount);
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		log->printf("DisplayHeadless::dumpFrame(): Failed open %s, %s\n", path, strerror(errno));
+		_dumpFormat = HEADLESS_DUMP_NONE;
+		return;
+	}
+
+	if (_dumpFormat == HEADLESS_DUMP_PPM) {
+		// pixels are premultiplied over black background, RGB is what display shows
+		U8 *row = (U8 *)malloc(_width * 3);
+		fprintf(f, "P6\n%u %u\n255\n", _width, _height);
+		for (U32 y = 0; y < _height && row; y++) {
+			const U32 *src = (const U32 *)(_buffer + y * _stride);
+			for (U32 x = 0; x < _width; x++) {
+				row[x * 3 + 0] = src[x] >> 16;
+				row[x * 3 + 1] = src[x] >> 8;
+				row[x * 3 + 2] = src[x];
+			}
+			fwrite(row, 3, _width, f);
+		}
+		free(row);
+	} else {
+		fwrite(_buffer, _stride, _height, f);
+	}
+
+	fclose(f);
+}
+
+STATUS DisplayHeadless::flip() {
+	if (!_initialized)
+		return S_FAIL;
+
+	U64 startTime = DisplayGetTimeUs();
+
+	// what renderer was allowed to write this frame, repainted or moved
+	getDamageRegion(getBufferAge(), _repaintRegion);
+	for (auto &rect : _repaintRegion) {
+		_damageBytes += (U64)rect.width * rect.height * 4;
+	}
+	submitDamage();
+	_bufferValid = true;
+	_frameCount++;
+
+	if (_dumpFormat != HEADLESS_DUMP_NONE)
+		dumpFrame();
+
+	// frame is queued here, vblank it waits for is its presentation
+	U64 sequence = recordSubmit(startTime);
+
+	// wait for next simulated vblank, like blocking page flip
+	if (_refreshRate) {
+		U64 period = 1000000 / _refreshRate;
+		U64 now = DisplayGetTimeUs();
+		U64 vblank = _vblankStart + ((now - _vblankStart) / period + 1) * period;
+		struct timespec ts = { (time_t)(vblank / 1000000), (long)(vblank % 1000000) * 1000 };
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+		recordPresent(sequence, vblank);
+	}
+
+	U64 flipTime = DisplayGetTimeUs() - startTime;
+	_flipTime += flipTime;
+	_flipTimeMax = MAX(_flipTimeMax, flipTime);
+
+	return S_OK;
+}
+
+void DisplayHeadless::clear() {
+	memset(_buffer, 0, _stride * _height);
+	_damageBytes += _stride * _height;
+}
+
+void DisplayHeadless::logStats() {
+	if (_frameCount == 0)
+		return;
+
+	log->printf("DisplayHeadless: %llu frames, %.1f KB damage per frame, flip %.2f ms avg %.2f ms max\n",
+	            (unsigned long long)_frameCount, _damageBytes / 1024.0 / _frameCount,
+	            _flipTime / 1000.0 / _frameCount, _flipTimeMax / 1000.0);
+}
+
+} // namespace
@@ -0,0 +1,90 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DISPLAY_HEADLESS_H
+#define DISPLAY_HEADLESS_H
+
+#include <string>
+
+#include "display_base.h"
+#include "basetypes.h"
+
+namespace MpvGui {
+
+typedef enum _HEADLESS_DUMP {
+    HEADLESS_DUMP_NONE,
+    HEADLESS_DUMP_PPM,
+    HEADLESS_DUMP_RAW,
+} HEADLESS_DUMP;
+
+// Display without output device, frames are kept in heap buffer and flips
+// are paced by simulated vblank clock. Used for profiling render path.
+class DisplayHeadless : public Display {
+private:
+
+	U32                     _width;
+	U32                     _height;
+	U32                     _stride;
+	U32                     _refreshRate;
+	U8                      *_buffer;
+	bool                    _bufferValid;
+
+	U64                     _vblankStart;      // us, first simulated vblank
+	U64                     _frameCount;
+	U64                     _damageBytes;      // renderer was allowed to write, upper bound
+	U64                     _flipTime;         // us, spent in flip() in total
+	U64                     _flipTimeMax;
+	std::vector<Rect>       _repaintRegion;
+
+	HEADLESS_DUMP           _dumpFormat;
+	std::string             _dumpPattern;      // path with single %d, or %0Nd, for frame number
+
+public:
+
+	DisplayHeadless();
+	~DisplayHeadless();
+
+	void setMode(U32 width, U32 height, U32 refreshRate);
+	void setDump(const char *pattern, HEADLESS_DUMP format);
+
+	STATUS init();
+	STATUS deinit();
+	void *getBufferPtr();
+	U32 getBufferWidth();
+	U32 getBufferHeight();
+	U32 getBufferStride();
+	STATUS flip();
+	void clear();
+
+	void logStats();
+
+protected:
+
+	U32 getBufferAge();
+
+private:
+
+	void dumpFrame();
+};
+
+} // namespace
+
+#endif
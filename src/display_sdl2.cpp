@@ -31,7 +31,8 @@ namespace MpvGui {
 #define SCREEN_HEIGHT (1080)
 
 DisplaySdl2::DisplaySdl2() :
-		_window(nullptr), _renderer(nullptr), _texture(nullptr), _backBuffer(nullptr) {
+		_window(nullptr), _renderer(nullptr), _texture(nullptr), _backBuffer(nullptr),
+		_backBufferValid(false), _zeroCopy(false), _locked(false), _vsync(false) {
 }
 
 DisplaySdl2::~DisplaySdl2() {
@@ -61,6 +62,9 @@ void *DisplaySdl2::getBufferPtr() {
 	if (!_initialized)
 		return nullptr;
 
+	if (_zeroCopy && lockTexture() == S_FAIL)
+		return nullptr;
+
 	return _backBuffer;
 }
 
@@ -82,23 +86,89 @@ U32 DisplaySdl2::getBufferStride() {
 	if (!_initialized)
 		return 0;
 
+	if (_zeroCopy && lockTexture() == S_FAIL)
+		return 0;
+
 	return _stride;
 }
 
+U32 DisplaySdl2::getBufferAge() {
+	if (_zeroCopy && lockTexture() == S_FAIL)
+		return 0;
+
+	// single back buffer, or texture memory keeping contents, is reused each frame
+	return _backBufferValid ? 1 : 0;
+}
+
+// Texture memory becomes back buffer until flip, contents are kept only
+// while renderer hands out same memory with same pitch
+STATUS DisplaySdl2::lockTexture() {
+	void *pixels;
+	int pitch;
+
+	if (_locked)
+		return S_OK;
+
+	if (SDL_LockTexture(_texture, nullptr, &pixels, &pitch) != 0) {
+		log->printf("DisplaySdl2::lockTexture(): Failed lock texture, %s\n", SDL_GetError());
+		return S_FAIL;
+	}
+	if (pixels != _backBuffer || pitch != _stride)
+		_backBufferValid = false;
+	_backBuffer = pixels;
+	_stride = pitch;
+	_locked = true;
+
+	return S_OK;
+}
+
+// Checks whether pixels written into locked texture survive unlock and lock
+bool DisplaySdl2::probeZeroCopy() {
+	const U32 marker[2] = { 0x12345678, 0x9abcdef0 };
+	void *pixels;
+	int pitch;
+	bool preserved;
+
+	if (SDL_LockTexture(_texture, nullptr, &pixels, &pitch) != 0)
+		return false;
+	if (pitch < _width * 4 || (pitch & 3)) {
+		SDL_UnlockTexture(_texture);
+		return false;
+	}
+	U32 *first = (U32 *)pixels;
+	U32 *last = (U32 *)((U8 *)pixels + pitch * (_height - 1)) + _width - 1;
+	*first = marker[0];
+	*last = marker[1];
+	SDL_UnlockTexture(_texture);
+
+	if (SDL_LockTexture(_texture, nullptr, &pixels, &pitch) != 0)
+		return false;
+	first = (U32 *)pixels;
+	last = (U32 *)((U8 *)pixels + pitch * (_height - 1)) + _width - 1;
+	preserved = *first == marker[0] && *last == marker[1];
+	SDL_UnlockTexture(_texture);
+
+	return preserved;
+}
+
 STATUS DisplaySdl2::internalInit() {
+	SDL_DisplayMode mode;
+	SDL_RendererInfo info;
+
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		log->printf("DisplaySdl2::internalInit(): Failed init SDL2, %d\n", SDL_GetError());
 		goto fail;
 	}
 
-	_width = SCREEN_WIDTH;
-	_height = SCREEN_HEIGHT;
-	_stride = _width * 4;
-	_backBuffer = malloc(_stride * _height);
-	if (!_backBuffer) {
-		log->printf("DisplaySdl2::internalInit(): Failed alloc back buffer\n");
-		goto fail;
+	if (SDL_GetDesktopDisplayMode(0, &mode) == 0) {
+		_width = mode.w;
+		_height = mode.h;
+		setRefreshPeriod(mode.refresh_rate ? 1000000 / mode.refresh_rate : 0);
+	} else {
+		_width = SCREEN_WIDTH;
+		_height = SCREEN_HEIGHT;
 	}
+	_backBufferValid = false;
 
 	_window = SDL_CreateWindow("MPV GUI",
                                    SDL_WINDOWPOS_UNDEFINED,
@@ -110,11 +180,12 @@ STATUS DisplaySdl2::internalInit() {
 		goto fail;
 	}
 
-	_renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED);
+	_renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (!_renderer) {
 		log->printf("DisplaySdl2::internalInit(): Failed init renderer, %d\n", SDL_GetError());
 		goto fail;
 	}
+	_vsync = SDL_GetRendererInfo(_renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC);
 
 	_texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, _width, _height);
 	if (!_texture) {
@@ -122,6 +193,20 @@ STATUS DisplaySdl2::internalInit() {
 		goto fail;
 	}
 
+	// unlock uploads whole texture, tile diff only pays off with damage upload
+	_stride = 0;
+	_zeroCopy = !_tileDiff && probeZeroCopy();
+	if (!_zeroCopy) {
+		_stride = _width * 4;
+		_backBuffer = malloc(_stride * _height);
+		if (!_backBuffer) {
+			log->printf("DisplaySdl2::internalInit(): Failed alloc back buffer\n");
+			goto fail;
+		}
+	}
+	log->printf("DisplaySdl2::internalInit(): %ux%u, %s, %s\n", _width, _height,
+	            _zeroCopy ? "zero-copy" : "damage upload", _vsync ? "vsync" : "no vsync");
+
 	_initialized = true;
 	return S_OK;
 
@@ -133,14 +218,22 @@ fail:
 }
 
 void DisplaySdl2::internalDeinit() {
-	if (_backBuffer)
+	if (_locked)
+		SDL_UnlockTexture(_texture);
+	_locked = false;
+	if (_backBuffer && !_zeroCopy)
 		free(_backBuffer);
+	_backBuffer = nullptr;
 	if (_texture)
 		SDL_DestroyTexture(_texture);
+	_texture = nullptr;
+	_textureTiles.hashes.clear();
 	if (_renderer)
 		SDL_DestroyRenderer(_renderer);
+	_renderer = nullptr;
 	if (_window)
 		SDL_DestroyWindow(_window);
+	_window = nullptr;
 
 	SDL_Quit();
 
@@ -151,22 +244,40 @@ STATUS DisplaySdl2::flip() {
 	if (!_initialized)
 		return S_FAIL;
 
-	void *pixels;
-	int pitch;
-	if (SDL_LockTexture(_texture, nullptr, &pixels, &pitch) != 0) {
-		goto fail;
-	}
-	for (int h = 0; h < _height; h++) {
-		memcpy((U8 *)pixels + (pitch * h), (U8 *)_backBuffer + (_stride * h), MIN(pitch, _stride));
+	U64 flipTime = DisplayGetTimeUs();
+	U64 sequence;
+
+	if (_zeroCopy) {
+		if (_locked) {
+			SDL_UnlockTexture(_texture);
+			_locked = false;
+		}
+	} else {
+		// texture keeps previous frame, only changed regions are uploaded
+		getDamageRegion(getBufferAge(), _uploadRegion);
+		Surface frame = { (U8 *)_backBuffer, _width, _height, _stride, PIXEL_FORMAT_ARGB8888 };
+		diffTiles(frame, _textureTiles, _uploadRegion);
+		for (auto &rect : _uploadRegion) {
+			SDL_Rect sdlRect = { rect.x, rect.y, rect.width, rect.height };
+			const U8 *pixels = (const U8 *)_backBuffer + rect.y * _stride + rect.x * 4;
+			if (SDL_UpdateTexture(_texture, &sdlRect, pixels, _stride) != 0)
+				goto fail;
+		}
 	}
 
-	SDL_UnlockTexture(_texture);
+	submitDamage();
+	_backBufferValid = true;
 
 	SDL_RenderCopy(_renderer, _texture, nullptr, nullptr);
 
 	SDL_RenderPresent(_renderer);
 
-	SDL_Delay(16);
+	// vsynced present returns after vblank, without it presentation is unknown
+	sequence = recordSubmit(flipTime);
+	if (_vsync)
+		recordPresent(sequence, DisplayGetTimeUs());
+	else
+		SDL_Delay(16);
 
 	return S_OK;
 
@@ -176,7 +287,10 @@ fail:
 }
 
 void DisplaySdl2::clear() {
-	memset(_backBuffer, 0, _stride * _height);
+	void *pixels = getBufferPtr();
+
+	if (pixels)
+		memset(pixels, 0, _stride * _height);
 }
 
 } // namespace
@@ -42,7 +42,13 @@ private:
 	SDL_Window              *_window;
 	SDL_Renderer            *_renderer;
 	SDL_Texture             *_texture;
-	void                    *_backBuffer;
+	void                    *_backBuffer;       // locked texture memory in zero-copy mode
+	bool                    _backBufferValid;
+	bool                    _zeroCopy;
+	bool                    _locked;
+	bool                    _vsync;
+	std::vector<Rect>       _uploadRegion;
+	TileHashes              _textureTiles;
 
 public:
 
@@ -58,10 +64,16 @@ public:
 	STATUS flip();
 	void clear();
 
+protected:
+
+	U32 getBufferAge();
+
 private:
 
 	STATUS internalInit();
 	void internalDeinit();
+	STATUS lockTexture();
+	bool probeZeroCopy();
 };
 
 } // namespace
@@ -21,23 +21,249 @@
 
 #include "basetypes.h"
 #include "logs.h"
+#include "blit.h"
 #include "fonts.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 #include <fontconfig/fontconfig.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
+#include FT_SIZES_H
 
 namespace MpvGui {
 
+#define ATLAS_WIDTH    1024
+#define ATLAS_HEIGHT   1024
+
+#define FONTS_CACHE_DIR      "mpv-gui"
+#define FONTS_CACHE_FILE     "fonts.cache"
+#define FONTS_CACHE_MAGIC    0x4347464d // 'MFGC'
+#define FONTS_CACHE_VERSION  5
+
+#define FONTS_CACHE_FLAG_KERNING  (1 << 0)
+
+#define MAX_FONT_FACES       16
+
+#define SDF_BASE_SIZE        64
+#define SDF_SPREAD           8
+
+// Distance field of glyph rasterized once at SDF_BASE_SIZE, 128 is the edge
+// and SDF_SPREAD pixels map to 127 steps. Position and size include padding.
+typedef struct {
+	std::vector<U8> field;
+	S32             width;
+	S32             height;
+	S32             left;
+	S32             top;
+	S32             advance;   // 26.6 fixed point
+} SdfGlyph;
+
+// Rasterized glyph coverage stored in one of the atlas pages, in SDF mode
+// scaled from distance field once per size
+typedef struct {
+	const U8        *bitmap;
+	U16             pitch;
+	U16             width;
+	U16             height;
+	S16             left;
+	S16             top;
+	S16             advance;
+	bool            bakedKerning; // pairs with other baked glyphs of size are in kerningCache
+} Glyph;
+
+// Atlas page filled with glyphs row by row (shelf packing)
+typedef struct {
+	U8              *pixels;
+	U32             shelfX;
+	U32             shelfY;
+	U32             shelfHeight;
+} AtlasPage;
+
+// Used pixel size, metrics come from primary face
+typedef struct {
+	int             pixelSize;
+	S32             ascender;
+	S32             descender;
+} FontSize;
+
+// Face in fallback chain, index 0 is primary face. FreeType face and its
+// per-size FT_Size objects (indexed like fontSizes) are created on first use.
+typedef struct {
+	std::string     path;
+	int             index;
+	FT_Face         face;
+	bool            failed;
+	bool            baked;      // rendered glyphs held by glyph cache
+	bool            hasCoverage;
+	std::unordered_map<U32, std::array<U32, 8>> coverage; // 256 codepoints per page
+	std::vector<FT_Size> sizes;
+} FontFace;
+
+// Layout of the baked cache file: header, faces, sizes, glyphs, atlas
+typedef struct {
+	U32             magic;
+	U32             version;
+	U32             flags;
+	U32             numFaces;
+	U32             facesOffset;
+	U32             numSizes;
+	U32             numGlyphs;
+	U32             numKerning;
+	U32             atlasWidth;
+	U32             atlasHeight;
+	U32             sizesOffset;
+	U32             glyphsOffset;
+	U32             kerningOffset;
+	U32             atlasOffset;
+} CacheHeader;
+
+// Font file glyphs were rendered from, first one is primary face
+typedef struct {
+	char            path[256];
+	S32             index;
+	U32             reserved;
+	U64             fileSize;
+	S64             fileTime;
+} CacheFace;
+
+typedef struct {
+	S32             pixelSize;
+	S32             ascender;
+	S32             descender;
+} CacheSize;
+
+typedef struct {
+	U32             codepoint;
+	S32             pixelSize;
+	U32             x;
+	U32             y;
+	U16             width;
+	U16             height;
+	S16             left;
+	S16             top;
+	S16             advance;
+	U16             reserved;
+} CacheGlyph;
+
+// Every non-zero pair between cached glyphs of same size
+typedef struct {
+	U32             left;
+	U32             right;
+	S32             pixelSize;
+	S32             kerning;
+} CacheKerning;
+
 static FT_Library ft;
-static FT_Face face;
+static std::vector<FontFace> fontFaces;
+static bool fallbackResolved;
+static std::unordered_map<U32, int> faceCache;
+static std::vector<AtlasPage> atlasPages;
+static std::vector<FontSize> fontSizes;
+static int currentSize = -1;
+static std::unordered_map<U64, Glyph> glyphCache;
+static std::unordered_set<U64> missingGlyphs; // failed loads, keyed like glyphCache
+static bool sdfMode;
+static std::unordered_map<U32, SdfGlyph> sdfCache;
+static std::unordered_map<U64, S16> kerningCache;
+static bool hasKerning;
+static std::unordered_map<std::string, S32> measureCache;
+static std::unordered_map<std::string, std::string> truncateCache;
+static void *cacheMap = MAP_FAILED;
+static size_t cacheMapSize;
+static bool cacheDirty;
+static std::vector<CacheFace> cachedFallbackFaces; // faces of glyphs loaded from cache
 
-bool FontsInit() {
-	FcResult result;
+// User cache directory, working directory is often read-only media root
+static std::string getCachePath(bool create) {
+	const char *cacheHome = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	std::string dir;
+
+	if (cacheHome && *cacheHome)
+		dir = cacheHome;
+	else if (home && *home)
+		dir = std::string(home) + "/.cache";
+	else
+		dir = "/tmp";
+	if (create)
+		mkdir(dir.c_str(), 0755);
+	dir += "/" FONTS_CACHE_DIR;
+	if (create)
+		mkdir(dir.c_str(), 0755);
+
+	return dir + "/" FONTS_CACHE_FILE;
+}
+
+static bool setCacheFace(CacheFace &cacheFace, const std::string &path, int index) {
+	struct stat st;
+
+	if (path.size() >= sizeof(cacheFace.path) || stat(path.c_str(), &st) != 0)
+		return false;
+	cacheFace = {};
+	strcpy(cacheFace.path, path.c_str());
+	cacheFace.index = index;
+	cacheFace.fileSize = st.st_size;
+	cacheFace.fileTime = st.st_mtime;
+
+	return true;
+}
+
+static bool isCacheFaceCurrent(const CacheFace &cacheFace) {
+	struct stat st;
+
+	return cacheFace.path[sizeof(cacheFace.path) - 1] == 0 && stat(cacheFace.path, &st) == 0 &&
+	       (U64)st.st_size == cacheFace.fileSize && st.st_mtime == cacheFace.fileTime;
+}
+
+static void setCoverage(FontFace &fontFace, FcCharSet *charset) {
+	FcChar32 map[FC_CHARSET_MAP_SIZE];
+	FcChar32 next;
+
+	for (FcChar32 base = FcCharSetFirstPage(charset, map, &next); base != FC_CHARSET_DONE;
+	     base = FcCharSetNextPage(charset, map, &next)) {
+		memcpy(fontFace.coverage[base >> 8].data(), map, sizeof(map));
+	}
+	fontFace.hasCoverage = true;
+}
+
+static void addFace(FcPattern *pattern) {
 	FcChar8 *fontFile;
+	FcCharSet *charset;
+	int index = 0;
+
+	if (FcPatternGetString(pattern, FC_FILE, 0, &fontFile) != FcResultMatch)
+		return;
+	FcPatternGetInteger(pattern, FC_INDEX, 0, &index);
+
+	for (auto &fontFace : fontFaces) {
+		if (fontFace.path == (const char *)fontFile && fontFace.index == index)
+			return;
+	}
+
+	FontFace fontFace{};
+	fontFace.path = (const char *)fontFile;
+	fontFace.index = index;
+	if (FcPatternGetCharSet(pattern, FC_CHARSET, 0, &charset) == FcResultMatch)
+		setCoverage(fontFace, charset);
+	fontFaces.push_back(fontFace);
+}
+
+static bool resolveFont() {
+	FcResult result;
 
 	if (!FcInit()) {
 		log->printf("Failed init font config!\n");
@@ -53,21 +279,12 @@ bool FontsInit() {
 		goto fail;
 	}
 
-	if (FcPatternGetString(matched, FC_FILE, 0, &fontFile) != FcResultMatch) {
+	addFace(matched);
+	if (fontFaces.empty()) {
 		log->printf("Failed get font!\n");
 		goto fail;
 	}
 
-	if (FT_Init_FreeType(&ft)) {
-		log->printf("Failed init freetype!\n");
-		goto fail;
-	}
-
-	if (FT_New_Face(ft, (const char *)fontFile, 0, &face)) {
-		log->printf("Failed load font!\n");
-		goto fail;
-	}
-
 	FcPatternDestroy(matched);
 	FcPatternDestroy(pattern);
 	pattern = matched = nullptr;
@@ -77,14 +294,6 @@ bool FontsInit() {
 	return true;
 
 fail:
-	if (face) {
-		FT_Done_Face(face);
-		face = nullptr;
-	}
-	if (ft) {
-		FT_Done_FreeType(ft);
-		ft = nullptr;
-	}
 	if (matched) {
 		FcPatternDestroy(matched);
 		matched = nullptr;
@@ -97,75 +306,866 @@ fail:
 	return false;
 }
 
+// Appends fonts sorted by fontconfig for the default pattern, keeping
+// only faces which add coverage, done once when primary face misses a glyph
+static void resolveFallbackFonts() {
+	FcResult result;
+
+	if (fallbackResolved)
+		return;
+	fallbackResolved = true;
+
+	if (!FcInit()) {
+		log->printf("Failed init font config!\n");
+		return;
+	}
+
+	auto pattern = FcNameParse((const FcChar8 *)"sans-serif");
+	FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+	FcDefaultSubstitute(pattern);
+	auto fontSet = FcFontSort(nullptr, pattern, FcTrue, nullptr, &result);
+	if (fontSet) {
+		for (int i = 0; i < fontSet->nfont && fontFaces.size() < MAX_FONT_FACES; i++) {
+			addFace(fontSet->fonts[i]);
+		}
+		FcFontSetDestroy(fontSet);
+	}
+	FcPatternDestroy(pattern);
+
+	FcFini();
+
+	log->printf("Font fallback chain has %d faces\n", (int)fontFaces.size());
+}
+
+static bool openFace(FontFace &fontFace) {
+	if (fontFace.face)
+		return true;
+	if (fontFace.failed)
+		return false;
+
+	if (!ft && FT_Init_FreeType(&ft)) {
+		log->printf("Failed init freetype!\n");
+		ft = nullptr;
+		return false;
+	}
+
+	if (FT_New_Face(ft, fontFace.path.c_str(), fontFace.index, &fontFace.face)) {
+		log->printf("Failed load font %s!\n", fontFace.path.c_str());
+		fontFace.face = nullptr;
+		fontFace.failed = true;
+		return false;
+	}
+
+	if (&fontFace == &fontFaces[0])
+		hasKerning = FT_HAS_KERNING(fontFace.face);
+
+	return true;
+}
+
+static bool activateSize(FontFace &fontFace, int sizeIndex) {
+	if (!openFace(fontFace))
+		return false;
+
+	if ((int)fontFace.sizes.size() <= sizeIndex)
+		fontFace.sizes.resize(sizeIndex + 1, nullptr);
+
+	FT_Size &size = fontFace.sizes[sizeIndex];
+	if (!size) {
+		if (FT_New_Size(fontFace.face, &size)) {
+			log->printf("activateSize(): Failed create size %d!\n", fontSizes[sizeIndex].pixelSize);
+			size = nullptr;
+			return false;
+		}
+		FT_Activate_Size(size);
+		if (FT_Set_Pixel_Sizes(fontFace.face, 0, fontSizes[sizeIndex].pixelSize)) {
+			log->printf("activateSize(): Failed set size %d!\n", fontSizes[sizeIndex].pixelSize);
+			FT_Done_Size(size);
+			size = nullptr;
+			return false;
+		}
+	}
+	if (fontFace.face->size != size)
+		FT_Activate_Size(size);
+
+	return true;
+}
+
+static bool hasCodepoint(FontFace &fontFace, U32 codepoint) {
+	if (fontFace.hasCoverage) {
+		auto it = fontFace.coverage.find(codepoint >> 8);
+		if (it == fontFace.coverage.end())
+			return false;
+		return (it->second[(codepoint & 0xff) >> 5] >> (codepoint & 0x1f)) & 1;
+	}
+
+	// no coverage from fontconfig, i.e. primary face loaded via fonts cache
+	if (!openFace(fontFace))
+		return false;
+	return FT_Get_Char_Index(fontFace.face, codepoint) != 0;
+}
+
+// Returns index of first face in chain having codepoint or -1, memoized
+static int resolveFace(U32 codepoint) {
+	auto it = faceCache.find(codepoint);
+	if (it != faceCache.end())
+		return it->second;
+
+	int result = -1;
+	if (hasCodepoint(fontFaces[0], codepoint)) {
+		result = 0;
+	} else {
+		resolveFallbackFonts();
+		for (size_t i = 1; i < fontFaces.size(); i++) {
+			if (hasCodepoint(fontFaces[i], codepoint)) {
+				result = i;
+				break;
+			}
+		}
+	}
+	faceCache[codepoint] = result;
+
+	return result;
+}
+
+static bool loadCache() {
+	struct stat st;
+	int fd = open(getCachePath(false).c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader)) {
+		close(fd);
+		return false;
+	}
+	cacheMapSize = st.st_size;
+	cacheMap = mmap(nullptr, cacheMapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (cacheMap == MAP_FAILED)
+		return false;
+
+	const U8 *base = (const U8 *)cacheMap;
+	const CacheHeader *header = (const CacheHeader *)base;
+	const CacheFace *faces;
+	const CacheSize *sizes;
+	const CacheGlyph *glyphs;
+	const CacheKerning *kerning;
+	const U8 *atlas;
+
+	if (header->magic != FONTS_CACHE_MAGIC || header->version != FONTS_CACHE_VERSION) {
+		log->printf("Fonts cache version mismatch, ignoring\n");
+		goto fail;
+	}
+	if (header->numFaces == 0 ||
+	    header->facesOffset + (U64)header->numFaces * sizeof(CacheFace) > cacheMapSize ||
+	    header->sizesOffset + (U64)header->numSizes * sizeof(CacheSize) > cacheMapSize ||
+	    header->glyphsOffset + (U64)header->numGlyphs * sizeof(CacheGlyph) > cacheMapSize ||
+	    header->kerningOffset + (U64)header->numKerning * sizeof(CacheKerning) > cacheMapSize ||
+	    header->atlasOffset + (U64)header->atlasWidth * header->atlasHeight > cacheMapSize) {
+		log->printf("Fonts cache corrupted, ignoring\n");
+		goto fail;
+	}
+	// fallback faces contributed baked glyphs too
+	faces = (const CacheFace *)(base + header->facesOffset);
+	for (U32 i = 0; i < header->numFaces; i++) {
+		if (!isCacheFaceCurrent(faces[i])) {
+			log->printf("Fonts cache outdated, ignoring\n");
+			goto fail;
+		}
+	}
+
+	fontFaces.emplace_back();
+	fontFaces.back().path = faces[0].path;
+	fontFaces.back().index = faces[0].index;
+	cachedFallbackFaces.assign(faces + 1, faces + header->numFaces);
+	hasKerning = header->flags & FONTS_CACHE_FLAG_KERNING;
+
+	sizes = (const CacheSize *)(base + header->sizesOffset);
+	for (U32 i = 0; i < header->numSizes; i++) {
+		fontSizes.push_back({ sizes[i].pixelSize, sizes[i].ascender, sizes[i].descender });
+	}
+
+	glyphs = (const CacheGlyph *)(base + header->glyphsOffset);
+	atlas = base + header->atlasOffset;
+	for (U32 i = 0; i < header->numGlyphs; i++) {
+		const CacheGlyph &entry = glyphs[i];
+		if (entry.x + entry.width > header->atlasWidth || entry.y + entry.height > header->atlasHeight)
+			continue;
+		Glyph glyph{};
+		glyph.width = entry.width;
+		glyph.height = entry.height;
+		glyph.left = entry.left;
+		glyph.top = entry.top;
+		glyph.advance = entry.advance;
+		glyph.bakedKerning = true;
+		if (glyph.width && glyph.height) {
+			glyph.bitmap = atlas + entry.y * header->atlasWidth + entry.x;
+			glyph.pitch = header->atlasWidth;
+		}
+		glyphCache[((U64)entry.pixelSize << 32) | entry.codepoint] = glyph;
+	}
+
+	kerning = (const CacheKerning *)(base + header->kerningOffset);
+	for (U32 i = 0; i < header->numKerning; i++) {
+		kerningCache[((U64)kerning[i].pixelSize << 42) | ((U64)kerning[i].left << 21) | kerning[i].right] = kerning[i].kerning;
+	}
+
+	log->printf("Loaded %u glyphs from fonts cache\n", header->numGlyphs);
+
+	return true;
+
+fail:
+	fontFaces.clear();
+	cachedFallbackFaces.clear();
+	fontSizes.clear();
+	glyphCache.clear();
+	kerningCache.clear();
+	munmap(cacheMap, cacheMapSize);
+	cacheMap = MAP_FAILED;
+	return false;
+}
+
+void FontsSetSdfMode(bool enable) {
+	sdfMode = enable;
+}
+
+bool FontsInit() {
+	// baked cache holds coverage bitmaps, distance fields are not stored there
+	if (!sdfMode && loadCache())
+		return true;
+
+	if (!resolveFont())
+		return false;
+
+	if (!openFace(fontFaces[0]))
+		return false;
+
+	return true;
+}
+
 void FontsDeinit() {
-	if (face) {
-		FT_Done_Face(face);
-		face = nullptr;
+	FontsFlushMeasureCache();
+	glyphCache.clear();
+	missingGlyphs.clear();
+	kerningCache.clear();
+	sdfCache.clear();
+	for (auto &page : atlasPages) {
+		free(page.pixels);
+	}
+	atlasPages.clear();
+	fontSizes.clear();
+	currentSize = -1;
+	cacheDirty = false;
+
+	if (cacheMap != MAP_FAILED) {
+		munmap(cacheMap, cacheMapSize);
+		cacheMap = MAP_FAILED;
+	}
+
+	// size objects are released together with their face
+	for (auto &fontFace : fontFaces) {
+		if (fontFace.face)
+			FT_Done_Face(fontFace.face);
 	}
+	fontFaces.clear();
+	faceCache.clear();
+	fallbackResolved = false;
+
 	if (ft) {
 		FT_Done_FreeType(ft);
 		ft = nullptr;
 	}
 }
 
+// Malformed input, like truncated sequence or Latin-1 byte, gives U+FFFD and
+// consumes only lead byte, so terminator is never skipped
 static U32 utf8_decode(const char *str, int &i) {
-	U32 c = (unsigned char)str[i];
+	U32 c = (unsigned char)str[i++];
+	int length;
+
+	if (c < 0x80)
+		return c;
+	if (c >= 0xF8 || c < 0xC0)
+		return 0xFFFD;
 	if (c >= 0xF0) {
-		c = ((c & 0x07) << 18) |
-		    ((unsigned char)str[i + 1] & 0x3F) << 12 |
-		    ((unsigned char)str[i + 2] & 0x3F) << 6 |
-		    ((unsigned char)str[i + 3] & 0x3F);
+		c &= 0x07;
+		length = 3;
 	} else if (c >= 0xE0) {
-		c = ((c & 0x0F) << 12) |
-		    ((unsigned char)str[i + 1] & 0x3F) << 6 |
-		    ((unsigned char)str[i + 2] & 0x3F);
-	} else if (c >= 0xC0) {
-		c = ((c & 0x1F) << 6) |
-		    ((unsigned char)str[i + 1] & 0x3F);
+		c &= 0x0F;
+		length = 2;
+	} else {
+		c &= 0x1F;
+		length = 1;
 	}
+	for (int n = 0; n < length; n++) {
+		U32 next = (unsigned char)str[i + n];
+		if ((next & 0xC0) != 0x80)
+			return 0xFFFD;
+		c = c << 6 | (next & 0x3F);
+	}
+	i += length;
+
 	return c;
 }
 
-static int utf8_strlen(const char *s) {
-	int length = 0;
+static int getSizeIndex(int size) {
+	for (int i = 0; i < (int)fontSizes.size(); i++) {
+		if (fontSizes[i].pixelSize == size)
+			return i;
+	}
 
-	while (*s) {
-		if ((*s & 0xc0) != 0x80) {
-			length++;
-		}
-		s++;
+	fontSizes.push_back({ size, 0, 0 });
+	if (!activateSize(fontFaces[0], fontSizes.size() - 1)) {
+		fontSizes.pop_back();
+		return -1;
 	}
-	return length;
+	FT_Size_Metrics &metrics = fontFaces[0].face->size->metrics;
+	fontSizes.back().ascender = metrics.ascender >> 6;
+	fontSizes.back().descender = metrics.descender >> 6;
+	cacheDirty = true;
+
+	return fontSizes.size() - 1;
 }
 
 void FontsSetSize(int size) {
-	FT_Set_Pixel_Sizes(face, 0, size);
+	int index = getSizeIndex(size);
+	if (index != -1)
+		currentSize = index;
 }
 
-void FontsRenderText(const char *text, U8 *buffer, U32 pos_x, U32 pos_y, U32 stride, U8 r, U8 g, U8 b) {
-	int len = utf8_strlen(text);
-	U32 orgPosY = pos_y;
-	stride /= 4;
+static U8 *atlasAlloc(U32 width, U32 height, U32 &pitch) {
+	if (width > ATLAS_WIDTH || height > ATLAS_HEIGHT)
+		return nullptr;
 
-	for (int i = 0; i < len; i++) {
-		if (FT_Load_Char(face, utf8_decode(text, i), FT_LOAD_RENDER)) {
-			continue;
+	AtlasPage *page = atlasPages.empty() ? nullptr : &atlasPages.back();
+	if (page && page->shelfX + width > ATLAS_WIDTH) {
+		page->shelfY += page->shelfHeight;
+		page->shelfX = page->shelfHeight = 0;
+	}
+	if (!page || page->shelfY + height > ATLAS_HEIGHT) {
+		AtlasPage newPage = { (U8 *)calloc(ATLAS_WIDTH, ATLAS_HEIGHT), 0, 0, 0 };
+		if (!newPage.pixels)
+			return nullptr;
+		atlasPages.push_back(newPage);
+		page = &atlasPages.back();
+	}
+
+	U8 *ptr = page->pixels + page->shelfY * ATLAS_WIDTH + page->shelfX;
+	page->shelfX += width;
+	page->shelfHeight = MAX(page->shelfHeight, height);
+	pitch = ATLAS_WIDTH;
+
+	return ptr;
+}
+
+// Squared euclidean distance transform of one row/column (Felzenszwalb & Huttenlocher)
+static void edt1d(float *grid, int offset, int stride, int length, float *f, float *z, int *v) {
+	for (int q = 0; q < length; q++) {
+		f[q] = grid[offset + q * stride];
+	}
+
+	int k = 0;
+	v[0] = 0;
+	z[0] = -1e20f;
+	z[1] = 1e20f;
+	for (int q = 1; q < length; q++) {
+		float s;
+		do {
+			int r = v[k];
+			s = (f[q] - f[r] + q * q - r * r) / (2 * (q - r));
+		} while (s <= z[k] && --k >= 0);
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = 1e20f;
+	}
+
+	k = 0;
+	for (int q = 0; q < length; q++) {
+		while (z[k + 1] < q)
+			k++;
+		int r = v[k];
+		grid[offset + q * stride] = f[r] + (q - r) * (q - r);
+	}
+}
+
+static void edt2d(std::vector<float> &grid, int width, int height) {
+	int length = MAX(width, height);
+	std::vector<float> f(length), z(length + 1);
+	std::vector<int> v(length);
+
+	for (int x = 0; x < width; x++) {
+		edt1d(grid.data(), x, width, height, f.data(), z.data(), v.data());
+	}
+	for (int y = 0; y < height; y++) {
+		edt1d(grid.data(), y * width, 1, width, f.data(), z.data(), v.data());
+	}
+}
+
+static const SdfGlyph *getSdfGlyph(U32 codepoint) {
+	auto it = sdfCache.find(codepoint);
+	if (it != sdfCache.end())
+		return &it->second;
+
+	int sizeIndex = getSizeIndex(SDF_BASE_SIZE);
+	if (sizeIndex == -1)
+		return nullptr;
+
+	int faceIndex = resolveFace(codepoint);
+	FontFace &fontFace = fontFaces[faceIndex < 0 ? 0 : faceIndex];
+	if (!activateSize(fontFace, sizeIndex))
+		return nullptr;
+	if (FT_Load_Char(fontFace.face, codepoint, FT_LOAD_RENDER))
+		return nullptr;
+
+	FT_GlyphSlot slot = fontFace.face->glyph;
+	SdfGlyph sdf{};
+	sdf.advance = slot->advance.x;
+
+	if (slot->bitmap.width && slot->bitmap.rows) {
+		sdf.width = slot->bitmap.width + 2 * SDF_SPREAD;
+		sdf.height = slot->bitmap.rows + 2 * SDF_SPREAD;
+		sdf.left = slot->bitmap_left - SDF_SPREAD;
+		sdf.top = slot->bitmap_top + SDF_SPREAD;
+
+		// partially covered pixels seed sub-pixel distances to the edge
+		std::vector<float> outer(sdf.width * sdf.height, 1e20f);
+		std::vector<float> inner(sdf.width * sdf.height, 0.0f);
+		for (int y = 0; y < (int)slot->bitmap.rows; y++) {
+			for (int x = 0; x < (int)slot->bitmap.width; x++) {
+				float a = slot->bitmap.buffer[y * slot->bitmap.pitch + x] / 255.0f;
+				int i = (y + SDF_SPREAD) * sdf.width + x + SDF_SPREAD;
+				if (a == 1.0f) {
+					outer[i] = 0.0f;
+					inner[i] = 1e20f;
+				} else if (a > 0.0f) {
+					outer[i] = MAX(0.0f, 0.5f - a) * MAX(0.0f, 0.5f - a);
+					inner[i] = MAX(0.0f, a - 0.5f) * MAX(0.0f, a - 0.5f);
+				}
+			}
+		}
+		edt2d(outer, sdf.width, sdf.height);
+		edt2d(inner, sdf.width, sdf.height);
+
+		sdf.field.resize(sdf.width * sdf.height);
+		for (size_t i = 0; i < sdf.field.size(); i++) {
+			float distance = sqrtf(outer[i]) - sqrtf(inner[i]);
+			sdf.field[i] = CLIP(lrintf(128.0f - distance * 127.0f / SDF_SPREAD), 0, 255);
 		}
+	}
 
-		U32 *dst = (U32 *)buffer;
-		FT_GlyphSlot f = face->glyph;
-		pos_y = orgPosY - f->bitmap_top;
-		for (int y = 0; y < f->bitmap.rows; y++) {
-			for (int x = 0; x < f->bitmap.width; x++) {
-				int offset = (pos_y + y) * stride + (pos_x + x);
-				unsigned char value = f->bitmap.buffer[y * f->bitmap.width + x];
-				if (value)
-					dst[offset] = value << 24 | r << 16 | g << 8 | b << 0;
+	return &sdfCache.emplace(codepoint, std::move(sdf)).first->second;
+}
+
+// Scales distance field to glyph box at pixel size and converts it to coverage
+static void renderSdfGlyph(const SdfGlyph *sdf, const Glyph &glyph, int pixelSize, U8 *dst, U32 pitch) {
+	float scale = (float)pixelSize / SDF_BASE_SIZE;
+	S32 sharpness = MIN(lrintf(SDF_SPREAD * scale * 255.0f / 127.0f * 256.0f), 32767);
+
+	for (int y = 0; y < glyph.height; y++) {
+		U8 *row = dst + y * pitch;
+		float fy = (-glyph.top + y + 0.5f) / scale + sdf->top - 0.5f;
+		int y0 = (int)floorf(fy);
+		int wy = lrintf((fy - y0) * 256.0f);
+		for (int x = 0; x < glyph.width; x++) {
+			float fx = (glyph.left + x + 0.5f) / scale - sdf->left - 0.5f;
+			int x0 = (int)floorf(fx);
+			int wx = lrintf((fx - x0) * 256.0f);
+			S32 samples[4];
+			for (int i = 0; i < 4; i++) {
+				int sx = x0 + (i & 1), sy = y0 + (i >> 1);
+				bool inside = sx >= 0 && sy >= 0 && sx < sdf->width && sy < sdf->height;
+				samples[i] = inside ? sdf->field[sy * sdf->width + sx] : 0;
 			}
+			S32 top = samples[0] * (256 - wx) + samples[1] * wx;
+			S32 bottom = samples[2] * (256 - wx) + samples[3] * wx;
+			row[x] = (top * (256 - wy) + bottom * wy + (1 << 15)) >> 16;
 		}
+		BlitSdfCoverage(row, row, sharpness, glyph.width);
+	}
+}
 
-		pos_x += f->advance.x >> 6;
+static const Glyph *getGlyph(U32 codepoint) {
+	if (currentSize == -1)
+		return nullptr;
+
+	int pixelSize = fontSizes[currentSize].pixelSize;
+	U64 key = ((U64)pixelSize << 32) | codepoint;
+	auto it = glyphCache.find(key);
+	if (it != glyphCache.end())
+		return &it->second;
+	if (missingGlyphs.count(key))
+		return nullptr;
+
+	if (sdfMode) {
+		// field is shared by all sizes, coverage of each size is kept in atlas
+		const SdfGlyph *sdf = getSdfGlyph(codepoint);
+		if (!sdf) {
+			missingGlyphs.insert(key);
+			return nullptr;
+		}
+		float scale = (float)pixelSize / SDF_BASE_SIZE;
+		Glyph glyph{};
+		glyph.advance = ((S64)sdf->advance * pixelSize / SDF_BASE_SIZE + 32) >> 6;
+		if (sdf->width) {
+			glyph.left = floorf(sdf->left * scale);
+			glyph.top = ceilf(sdf->top * scale);
+			glyph.width = ceilf((sdf->left + sdf->width) * scale) - glyph.left;
+			glyph.height = glyph.top - floorf((sdf->top - sdf->height) * scale);
+		}
+		if (glyph.width && glyph.height) {
+			U32 pitch;
+			U8 *dst = atlasAlloc(glyph.width, glyph.height, pitch);
+			if (!dst) {
+				log->printf("getGlyph(): Failed alloc atlas space for glyph %u!\n", codepoint);
+				return nullptr;
+			}
+			renderSdfGlyph(sdf, glyph, pixelSize, dst, pitch);
+			glyph.bitmap = dst;
+			glyph.pitch = pitch;
+		}
+		return &glyphCache.emplace(key, glyph).first->second;
+	}
+
+	// codepoints missing in every face render as primary face's missing glyph
+	int faceIndex = resolveFace(codepoint);
+	FontFace &fontFace = fontFaces[faceIndex < 0 ? 0 : faceIndex];
+	if (!activateSize(fontFace, currentSize))
+		return nullptr;
+	if (FT_Load_Char(fontFace.face, codepoint, FT_LOAD_RENDER)) {
+		missingGlyphs.insert(key);
+		return nullptr;
+	}
+	fontFace.baked = true;
+
+	FT_GlyphSlot slot = fontFace.face->glyph;
+	Glyph glyph{};
+	glyph.width = slot->bitmap.width;
+	glyph.height = slot->bitmap.rows;
+	glyph.left = slot->bitmap_left;
+	glyph.top = slot->bitmap_top;
+	glyph.advance = slot->advance.x >> 6;
+
+	if (glyph.width && glyph.height) {
+		U32 pitch;
+		U8 *dst = atlasAlloc(glyph.width, glyph.height, pitch);
+		if (!dst) {
+			log->printf("getGlyph(): Failed alloc atlas space for glyph %u!\n", codepoint);
+			return nullptr;
+		}
+		for (int y = 0; y < glyph.height; y++) {
+			memcpy(dst + y * pitch, slot->bitmap.buffer + y * slot->bitmap.pitch, glyph.width);
+		}
+		glyph.bitmap = dst;
+		glyph.pitch = pitch;
 	}
+
+	cacheDirty = true;
+
+	return &glyphCache.emplace(key, glyph).first->second;
+}
+
+// Kerning is applied only between glyphs of primary face
+static S32 loadKerning(U32 left, U32 right) {
+	FT_Vector delta{};
+
+	if (resolveFace(left) == 0 && resolveFace(right) == 0 && activateSize(fontFaces[0], currentSize)) {
+		FT_Face face = fontFaces[0].face;
+		FT_Get_Kerning(face, FT_Get_Char_Index(face, left), FT_Get_Char_Index(face, right), FT_KERNING_DEFAULT, &delta);
+	}
+
+	return delta.x >> 6;
+}
+
+void FontsSaveCache() {
+	if (!cacheDirty || sdfMode)
+		return;
+
+	// bake printable ASCII for every used size next to glyphs seen so far,
+	// then every non-zero pair so cached glyphs never ask FreeType for kerning
+	int savedSize = currentSize;
+	for (currentSize = 0; currentSize < (int)fontSizes.size(); currentSize++) {
+		for (U32 c = 0x20; c < 0x7f; c++) {
+			getGlyph(c);
+		}
+		if (!hasKerning)
+			continue;
+		U64 pixelSize = fontSizes[currentSize].pixelSize;
+		std::vector<std::pair<U32, const Glyph *>> sizeGlyphs;
+		for (auto &it : glyphCache) {
+			if ((it.first >> 32) == pixelSize)
+				sizeGlyphs.push_back({ it.first & 0xffffffff, &it.second });
+		}
+		for (auto &left : sizeGlyphs) {
+			for (auto &right : sizeGlyphs) {
+				U64 key = (pixelSize << 42) | ((U64)left.first << 21) | right.first;
+				if ((left.second->bakedKerning && right.second->bakedKerning) || kerningCache.count(key))
+					continue;
+				S32 kerning = loadKerning(left.first, right.first);
+				if (kerning)
+					kerningCache[key] = kerning;
+			}
+		}
+	}
+	currentSize = savedSize;
+
+	std::vector<std::pair<U64, const Glyph *>> entries;
+	for (auto &it : glyphCache) {
+		entries.push_back({ it.first, &it.second });
+	}
+	std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+		return a.second->height > b.second->height;
+	});
+
+	std::vector<CacheGlyph> glyphs;
+	U32 shelfX = 0, shelfY = 0, shelfHeight = 0;
+	for (auto &entry : entries) {
+		const Glyph *glyph = entry.second;
+		if (shelfX + glyph->width > ATLAS_WIDTH) {
+			shelfY += shelfHeight;
+			shelfX = shelfHeight = 0;
+		}
+		CacheGlyph cacheGlyph{};
+		cacheGlyph.codepoint = entry.first & 0xffffffff;
+		cacheGlyph.pixelSize = entry.first >> 32;
+		cacheGlyph.x = shelfX;
+		cacheGlyph.y = shelfY;
+		cacheGlyph.width = glyph->width;
+		cacheGlyph.height = glyph->height;
+		cacheGlyph.left = glyph->left;
+		cacheGlyph.top = glyph->top;
+		cacheGlyph.advance = glyph->advance;
+		glyphs.push_back(cacheGlyph);
+		shelfX += glyph->width;
+		shelfHeight = MAX(shelfHeight, glyph->height);
+	}
+
+	std::vector<CacheSize> sizes;
+	for (auto &fontSize : fontSizes) {
+		sizes.push_back({ fontSize.pixelSize, fontSize.ascender, fontSize.descender });
+	}
+
+	std::vector<CacheKerning> kerning;
+	for (auto &it : kerningCache) {
+		if (it.second == 0)
+			continue;
+		kerning.push_back({ (U32)(it.first >> 21) & 0x1fffff, (U32)it.first & 0x1fffff, (S32)(it.first >> 42), it.second });
+	}
+
+	// primary face first, then every fallback face glyphs came from
+	std::vector<CacheFace> faces(1);
+	if (!setCacheFace(faces[0], fontFaces[0].path, fontFaces[0].index))
+		return;
+	for (size_t i = 1; i < fontFaces.size(); i++) {
+		if (!fontFaces[i].baked)
+			continue;
+		faces.emplace_back();
+		if (!setCacheFace(faces.back(), fontFaces[i].path, fontFaces[i].index))
+			return;
+	}
+	for (auto &cacheFace : cachedFallbackFaces) {
+		auto it = std::find_if(faces.begin(), faces.end(), [&](const CacheFace &face) {
+			return strcmp(face.path, cacheFace.path) == 0 && face.index == cacheFace.index;
+		});
+		if (it == faces.end())
+			faces.push_back(cacheFace);
+	}
+
+	CacheHeader header{};
+	header.magic = FONTS_CACHE_MAGIC;
+	header.version = FONTS_CACHE_VERSION;
+	header.flags = hasKerning ? FONTS_CACHE_FLAG_KERNING : 0;
+	header.numFaces = faces.size();
+	header.numSizes = sizes.size();
+	header.numGlyphs = glyphs.size();
+	header.numKerning = kerning.size();
+	header.atlasWidth = ATLAS_WIDTH;
+	header.atlasHeight = shelfY + shelfHeight;
+	header.facesOffset = sizeof(header);
+	header.sizesOffset = header.facesOffset + faces.size() * sizeof(CacheFace);
+	header.glyphsOffset = header.sizesOffset + sizes.size() * sizeof(CacheSize);
+	header.kerningOffset = header.glyphsOffset + glyphs.size() * sizeof(CacheGlyph);
+	header.atlasOffset = header.kerningOffset + kerning.size() * sizeof(CacheKerning);
+
+	std::vector<U8> atlas((size_t)header.atlasWidth * header.atlasHeight);
+	for (size_t i = 0; i < glyphs.size(); i++) {
+		const Glyph *glyph = entries[i].second;
+		if (!glyph->bitmap)
+			continue;
+		for (int y = 0; y < glyph->height; y++) {
+			memcpy(&atlas[(glyphs[i].y + y) * header.atlasWidth + glyphs[i].x],
+			       glyph->bitmap + y * glyph->pitch, glyph->width);
+		}
+	}
+
+	// write into temporary file first, current cache may still be mapped
+	std::string cacheFile = getCachePath(true);
+	std::string tmpFile = cacheFile + ".tmp";
+	FILE *file = fopen(tmpFile.c_str(), "wb");
+	if (!file) {
+		log->printf("FontsSaveCache(): Failed create %s\n", tmpFile.c_str());
+		return;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(faces.data(), sizeof(CacheFace), faces.size(), file) == faces.size();
+	ok = ok && fwrite(sizes.data(), sizeof(CacheSize), sizes.size(), file) == sizes.size();
+	ok = ok && fwrite(glyphs.data(), sizeof(CacheGlyph), glyphs.size(), file) == glyphs.size();
+	ok = ok && fwrite(kerning.data(), sizeof(CacheKerning), kerning.size(), file) == kerning.size();
+	ok = ok && fwrite(atlas.data(), 1, atlas.size(), file) == atlas.size();
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+		log->printf("FontsSaveCache(): Failed write fonts cache\n");
+		unlink(tmpFile.c_str());
+		return;
+	}
+
+	log->printf("Saved %u glyphs into fonts cache\n", header.numGlyphs);
+	for (auto &it : glyphCache) {
+		it.second.bakedKerning = true;
+	}
+	cacheDirty = false;
+}
+
+static S32 getKerning(U32 left, const Glyph *leftGlyph, U32 right, const Glyph *rightGlyph) {
+	if (!hasKerning || currentSize == -1)
+		return 0;
+
+	FontSize &fontSize = fontSizes[currentSize];
+	U64 key = ((U64)fontSize.pixelSize << 42) | ((U64)left << 21) | right;
+	auto it = kerningCache.find(key);
+	if (it != kerningCache.end())
+		return it->second;
+	// pair missing in baked table has no kerning, FreeType stays closed
+	if (leftGlyph->bakedKerning && rightGlyph->bakedKerning)
+		return 0;
+
+	S32 kerning = loadKerning(left, right);
+	kerningCache[key] = kerning;
+	cacheDirty = true;
+
+	return kerning;
+}
+
+// Walks glyphs of text with kerning applied, func(glyph, pos_x, byteOffset)
+// returns false to stop. Result is pen position after last visited glyph.
+template <typename F>
+static S32 layoutText(const char *text, F func) {
+	S32 pos_x = 0;
+	U32 prev = 0;
+	const Glyph *prevGlyph = nullptr;
+
+	for (int i = 0; text[i];) {
+		int offset = i;
+		U32 codepoint = utf8_decode(text, i);
+		const Glyph *glyph = getGlyph(codepoint);
+		if (!glyph) {
+			continue;
+		}
+
+		if (prev)
+			pos_x += getKerning(prev, prevGlyph, codepoint, glyph);
+		prev = codepoint;
+		prevGlyph = glyph;
+
+		if (!func(glyph, pos_x, offset))
+			break;
+
+		pos_x += glyph->advance;
+	}
+
+	return pos_x;
+}
+
+static std::string measureKey(const std::string &text, S32 extra) {
+	std::string key;
+	S32 size = currentSize == -1 ? 0 : fontSizes[currentSize].pixelSize;
+	key.reserve(text.size() + sizeof(size) + sizeof(extra));
+	key.append((const char *)&size, sizeof(size));
+	key.append((const char *)&extra, sizeof(extra));
+	key.append(text);
+	return key;
+}
+
+void FontsFlushMeasureCache() {
+	measureCache.clear();
+	truncateCache.clear();
+}
+
+S32 FontsMeasureText(const std::string &text) {
+	std::string key = measureKey(text, 0);
+	auto it = measureCache.find(key);
+	if (it != measureCache.end())
+		return it->second;
+
+	S32 width = layoutText(text.c_str(), [](const Glyph *, S32, int) {
+		return true;
+	});
+	measureCache[key] = width;
+
+	return width;
+}
+
+std::string FontsTruncateText(const std::string &text, S32 maxWidth) {
+	if (FontsMeasureText(text) <= maxWidth)
+		return text;
+
+	std::string key = measureKey(text, maxWidth);
+	auto it = truncateCache.find(key);
+	if (it != truncateCache.end())
+		return it->second;
+
+	const char *ellipsis = "...";
+	S32 limit = maxWidth - FontsMeasureText(ellipsis);
+	size_t length = 0;
+	layoutText(text.c_str(), [&](const Glyph *glyph, S32 pos_x, int offset) {
+		length = offset;
+		return pos_x + glyph->advance <= limit;
+	});
+	while (length > 0 && text[length - 1] == ' ')
+		length--;
+
+	std::string result = text.substr(0, length) + ellipsis;
+	truncateCache[key] = result;
+
+	return result;
+}
+
+void FontsGetTextBounds(const char *text, S32 &left, S32 &top, S32 &right, S32 &bottom) {
+	left = top = right = bottom = 0;
+	if (currentSize != -1) {
+		top = -fontSizes[currentSize].ascender;
+		bottom = -fontSizes[currentSize].descender;
+	}
+
+	S32 width = layoutText(text, [&](const Glyph *glyph, S32 pos_x, int) {
+		if (glyph->width && glyph->height) {
+			left = MIN(left, pos_x + glyph->left);
+			right = MAX(right, pos_x + glyph->left + glyph->width);
+			top = MIN(top, -glyph->top);
+			bottom = MAX(bottom, -glyph->top + glyph->height);
+		}
+		return true;
+	});
+	right = MAX(right, width);
+}
+
+void FontsRenderText(const char *text, const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y, U8 r, U8 g, U8 b) {
+	U32 color = 0xff << 24 | r << 16 | g << 8 | b << 0;
+	S32 clipLeft = MAX(clip.x, 0);
+	S32 clipRight = MIN(clip.x + clip.width, (S32)surface.width);
+
+	layoutText(text, [&](const Glyph *glyph, S32 pen_x, int) {
+		S32 x = pos_x + pen_x + glyph->left;
+		// glyphs are laid out left to right, nothing more is visible past the right edge
+		if (x >= clipRight)
+			return false;
+		if (x + glyph->width <= clipLeft)
+			return true;
+		if (glyph->bitmap) {
+			BlitMask(surface, clip, x, pos_y - glyph->top,
+			         glyph->bitmap, glyph->pitch, glyph->width, glyph->height, color);
+		}
+		return true;
+	});
 }
 
 } // namespace
@@ -22,12 +22,22 @@
 #ifndef FONTS_H
 #define FONTS_H
 
+#include <string>
+
+#include "blit.h"
+
 namespace MpvGui {
 
+void FontsSetSdfMode(bool enable);
 bool FontsInit();
 void FontsDeinit();
+void FontsSaveCache();
 void FontsSetSize(int size);
-void FontsRenderText(const char *text, U8 *buffer, U32 pos_x, U32 pos_y, U32 stride, U8 r, U8 g, U8 b);
+void FontsFlushMeasureCache();
+S32 FontsMeasureText(const std::string &text);
+std::string FontsTruncateText(const std::string &text, S32 maxWidth);
+void FontsGetTextBounds(const char *text, S32 &left, S32 &top, S32 &right, S32 &bottom);
+void FontsRenderText(const char *text, const Surface &surface, const Rect &clip, S32 pos_x, S32 pos_y, U8 r, U8 g, U8 b);
 
 } // namespace
 
@@ -0,0 +1,146 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+
+// Standalone check of SDF glyphs against FreeType rendered ones, built with
+// "make fonts-test". Each printable ASCII glyph is drawn alone at several
+// sizes in both modes. Total coverage differing by more than TEST_MAX_INK_ERROR,
+// its centroid moved by more than TEST_MAX_OFFSET pixels, or advance off by
+// more than a pixel fails, as do edges overall softer or sharper than
+// TEST_MAX_BLUR times FreeType ones.
+
+#include "basetypes.h"
+#include "logs.h"
+#include "blit.h"
+#include "fonts.h"
+
+#include <stdio.h>
+#include <vector>
+
+using namespace MpvGui;
+
+#define TEST_SURFACE_SIZE  160
+#define TEST_MAX_INK_ERROR 0.35f // hinting snaps thin stems to whole pixels
+#define TEST_MIN_INK_SLACK 8.0f  // pixels of coverage, for punctuation
+#define TEST_MAX_OFFSET    1.5f
+#define TEST_MAX_BLUR      1.5f // ratio of all edge coverage, either way
+
+static const int testSizes[] = { 20, 30, 45, 60, 90 };
+
+typedef struct {
+	std::vector<U32>    pixels;
+	S32                 advance;
+} GlyphImage;
+
+// White glyph over transparent black, alpha holds coverage
+static void renderGlyphs(std::vector<GlyphImage> &images) {
+	for (int size : testSizes) {
+		FontsSetSize(size);
+		for (char c = 0x21; c < 0x7f; c++) {
+			char text[2] = { c, 0 };
+			GlyphImage image;
+			image.pixels.resize(TEST_SURFACE_SIZE * TEST_SURFACE_SIZE);
+			Surface surface = { (U8 *)image.pixels.data(), TEST_SURFACE_SIZE, TEST_SURFACE_SIZE,
+			                    TEST_SURFACE_SIZE * 4, PIXEL_FORMAT_ARGB8888 };
+			Rect clip = { 0, 0, TEST_SURFACE_SIZE, TEST_SURFACE_SIZE };
+			FontsRenderText(text, surface, clip, TEST_SURFACE_SIZE / 4, TEST_SURFACE_SIZE * 3 / 4, 255, 255, 255);
+			image.advance = FontsMeasureText(text);
+			images.push_back(std::move(image));
+		}
+	}
+}
+
+// Total coverage, partial coverage along edges and coverage centroid, hinting
+// moves edges of FreeType glyphs by a pixel so per pixel comparison is meaningless
+static void measureInk(const std::vector<U32> &pixels, float &ink, float &edge, float &centerX, float &centerY) {
+	U64 sum = 0, sumEdge = 0, sumX = 0, sumY = 0;
+
+	for (int y = 0; y < TEST_SURFACE_SIZE; y++) {
+		for (int x = 0; x < TEST_SURFACE_SIZE; x++) {
+			U32 coverage = pixels[y * TEST_SURFACE_SIZE + x] >> 24;
+			sum += coverage;
+			sumEdge += MIN(coverage, 255 - coverage);
+			sumX += coverage * x;
+			sumY += coverage * y;
+		}
+	}
+	ink = sum / 255.0f;
+	edge = sumEdge / 127.0f;
+	centerX = sum ? (float)sumX / sum : 0;
+	centerY = sum ? (float)sumY / sum : 0;
+}
+
+static bool loadGlyphs(bool sdf, std::vector<GlyphImage> &images) {
+	FontsSetSdfMode(sdf);
+	if (!FontsInit()) {
+		printf("Failed init fonts\n");
+		return false;
+	}
+	renderGlyphs(images);
+	FontsDeinit();
+
+	return true;
+}
+
+int main() {
+	std::vector<GlyphImage> expected, result;
+	float worstError = 0, worstOffset = 0, edgesExpected = 0, edgesResult = 0;
+	int failed = 0;
+
+	if (CreateLogs() == S_FAIL)
+		return 1;
+	BlitInit(BLIT_KERNEL_AUTO);
+
+	if (!loadGlyphs(false, expected) || !loadGlyphs(true, result)) {
+		delete log;
+		return 1;
+	}
+
+	for (size_t i = 0; i < expected.size(); i++) {
+		int size = testSizes[i / (0x7f - 0x21)];
+		char c = 0x21 + i % (0x7f - 0x21);
+		float inkExpected, edgeExpected, xExpected, yExpected, inkResult, edgeResult, xResult, yResult;
+		measureInk(expected[i].pixels, inkExpected, edgeExpected, xExpected, yExpected);
+		measureInk(result[i].pixels, inkResult, edgeResult, xResult, yResult);
+		float error = ABS(inkResult - inkExpected) / MAX(inkExpected, TEST_MIN_INK_SLACK / TEST_MAX_INK_ERROR);
+		edgesExpected += edgeExpected;
+		edgesResult += edgeResult;
+		float offset = MAX(ABS(xResult - xExpected), ABS(yResult - yExpected));
+		worstError = MAX(worstError, error);
+		worstOffset = MAX(worstOffset, offset);
+		if (error > TEST_MAX_INK_ERROR || offset > TEST_MAX_OFFSET ||
+		    ABS(expected[i].advance - result[i].advance) > 1) {
+			printf("'%c' size %d: ink %.0f vs %.0f, centroid off %.2f, advance %d vs %d\n",
+			       c, size, inkExpected, inkResult, offset, expected[i].advance, result[i].advance);
+			failed++;
+		}
+	}
+	// single glyph edges are too few pixels, hinted stems have none
+	float blur = edgesResult / edgesExpected;
+	if (blur > TEST_MAX_BLUR || blur < 1 / TEST_MAX_BLUR)
+		failed++;
+	printf("SDF glyphs %s, worst ink error %.2f, centroid offset %.2f, edges %.2fx\n",
+	       failed ? "FAILED" : "ok", worstError, worstOffset, blur);
+
+	delete log;
+
+	return failed ? 1 : 0;
+}
@@ -61,6 +61,7 @@ Fs::~Fs() {
 
 void Fs::GetMediaEntries(std::vector<FsEntry> &entries) {
 	entries.clear();
+	listingGeneration = 0;
 	std::vector<std::string> dirs;
 	std::vector<std::string> files;
 
@@ -126,6 +127,15 @@ void Fs::GetMediaEntries(std::vector<FsEntry> &entries) {
 		entry.name = it;
 		entries.push_back(entry);
 	}
+
+	// FNV-1a, entry type is hashed as separator
+	U64 hash = 0xcbf29ce484222325ULL;
+	for (const auto &it : entries) {
+		hash = (hash ^ (it.type + 1)) * 0x100000001b3ULL;
+		for (unsigned char c : it.name)
+			hash = (hash ^ c) * 0x100000001b3ULL;
+	}
+	listingGeneration = hash;
 }
 
 bool Fs::EnterDirectory(std::string name) {
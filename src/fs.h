@@ -50,6 +50,7 @@ private:
 	std::vector<std::string> mediaExtensions;
 	CURL *curl{};
 	std::string curlBuffer;
+	unsigned long long listingGeneration{};
 
 public:
 
@@ -59,6 +60,8 @@ public:
 	std::string CurrentPath() { return currentPath; }
 	void AddMediaExtension(std::string ext) { mediaExtensions.push_back(ext); }
 	void GetMediaEntries(std::vector<FsEntry> &entries);
+	// Hash of entries returned by last GetMediaEntries, changes with directory contents
+	unsigned long long ListingGeneration() { return listingGeneration; }
 	bool EnterDirectory(std::string name);
 	bool ExitDirectory();
 };
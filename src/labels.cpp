@@ -0,0 +1,123 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "basetypes.h"
+#include "logs.h"
+#include "fonts.h"
+#include "labels.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <unordered_map>
+
+namespace MpvGui {
+
+#define DEFAULT_LABELS_BUDGET (16 * 1024 * 1024)
+
+typedef struct {
+	std::string             key;
+	std::shared_ptr<Label>  label;
+	U32                     bytes;
+} LabelEntry;
+
+static std::list<LabelEntry> lruList;
+static std::unordered_map<std::string, std::list<LabelEntry>::iterator> labelsMap;
+static U32 labelsBudget = DEFAULT_LABELS_BUDGET;
+static U32 labelsBytes;
+
+static void freeLabel(Label *label) {
+	free(label->pixels);
+	delete label;
+}
+
+static void evict() {
+	// keep at least most recently used label even if it exceeds budget
+	while (labelsBytes > labelsBudget && lruList.size() > 1) {
+		auto &entry = lruList.back();
+		labelsBytes -= entry.bytes;
+		labelsMap.erase(entry.key);
+		lruList.pop_back();
+	}
+}
+
+void LabelsSetBudget(U32 bytes) {
+	labelsBudget = bytes;
+	evict();
+}
+
+void LabelsFlush() {
+	labelsMap.clear();
+	lruList.clear();
+	labelsBytes = 0;
+}
+
+static std::string makeKey(const std::string &text, int size, U32 color) {
+	std::string key;
+	key.reserve(text.size() + sizeof(size) + sizeof(color));
+	key.append((const char *)&size, sizeof(size));
+	key.append((const char *)&color, sizeof(color));
+	key.append(text);
+	return key;
+}
+
+std::shared_ptr<Label> LabelsGet(const std::string &text, int size, U8 r, U8 g, U8 b) {
+	U32 color = r << 16 | g << 8 | b << 0;
+	std::string key = makeKey(text, size, color);
+
+	auto it = labelsMap.find(key);
+	if (it != labelsMap.end()) {
+		lruList.splice(lruList.begin(), lruList, it->second);
+		return it->second->label;
+	}
+
+	S32 left, top, right, bottom;
+	FontsSetSize(size);
+	FontsGetTextBounds(text.c_str(), left, top, right, bottom);
+
+	Label *label = new Label;
+	label->width = right - left;
+	label->height = bottom - top;
+	label->originX = -left;
+	label->originY = -top;
+	label->pixels = (U32 *)calloc(label->width * label->height + 1, sizeof(U32));
+	if (!label->pixels) {
+		log->printf("LabelsGet(): Failed alloc label %ux%u\n", label->width, label->height);
+		delete label;
+		return nullptr;
+	}
+	Surface surface = { (U8 *)label->pixels, label->width, label->height, label->width * 4, PIXEL_FORMAT_ARGB8888 };
+	Rect clip = { 0, 0, (S32)label->width, (S32)label->height };
+	FontsRenderText(text.c_str(), surface, clip, label->originX, label->originY, r, g, b);
+
+	LabelEntry entry;
+	entry.key = key;
+	entry.label = std::shared_ptr<Label>(label, freeLabel);
+	entry.bytes = label->width * label->height * 4 + sizeof(Label) + key.size();
+	lruList.push_front(entry);
+	labelsMap[key] = lruList.begin();
+	labelsBytes += entry.bytes;
+	evict();
+
+	return entry.label;
+}
+
+} // namespace
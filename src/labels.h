@@ -0,0 +1,47 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef LABELS_H
+#define LABELS_H
+
+#include <string>
+#include <memory>
+
+#include "basetypes.h"
+
+namespace MpvGui {
+
+// Text string composed once into a premultiplied ARGB bitmap
+typedef struct {
+	U32             *pixels;
+	U32             width;
+	U32             height;
+	S32             originX;   // pen start position inside bitmap
+	S32             originY;   // baseline position inside bitmap
+} Label;
+
+void LabelsSetBudget(U32 bytes);
+void LabelsFlush();
+std::shared_ptr<Label> LabelsGet(const std::string &text, int size, U8 r, U8 g, U8 b);
+
+} // namespace
+
+#endif
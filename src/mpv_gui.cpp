@@ -20,18 +20,296 @@
  */
 
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <functional>
 
 #include "basetypes.h"
 #include "logs.h"
 #include "display_base.h"
+#include "display_headless.h"
+#include "blit.h"
 #include "fonts.h"
+#include "labels.h"
+#include "render.h"
+#include "snapshots.h"
 #include "remote.h"
 #include "fs.h"
 
 namespace MpvGui {
 
+#define MARQUEE_STEP_US      16000
+#define MARQUEE_PAUSE_US     1500000
+
+#define LIST_ROWS            30
+#define SCROLL_LAYER_ROWS    90
+
+#define SCROLL_STEP_US       16000
+#define SCROLL_JUMP_ROWS     (LIST_ROWS / 2)
+
+#define SELECTION_MARKER     " <---"
+#define SELECTION_BAR_COLOR  0x40004040   // premultiplied, dim cyan
+
+// Selected entry wider than its row, full text is composed once into label
+// and each animation step blits moving window of it into row rectangle
+typedef struct {
+	std::string             text;
+	int                     size;
+	U8                      r, g, b;
+	Rect                    rect;
+	S32                     baseline;
+	S32                     scroll;
+	S32                     maxScroll;
+	S32                     speed;
+	U64                     nextTime;
+} Marquee;
+
+// List rows composed into tall buffer on own plane, scrolling only moves
+// plane source window. Each buffer row remembers what was drawn into it
+// and is redrawn only when it comes into view with different content.
+// Rows are drawn into cached copy, display copies them to plane buffer.
+typedef struct {
+	bool                    enabled;
+	Rect                    window;     // visible part, screen coordinates
+	S32                     rowHeight;
+	int                     rows;       // rows held by buffer
+	int                     base;       // entry shown in first buffer row
+	std::vector<RenderList> content;    // drawn items per row, buffer coordinates
+	std::vector<bool>       valid;
+} ScrollLayer;
+
+// List position animated in pixels towards first visible entry, each step
+// covers quarter of remaining distance so scrolling slows down at the end
+typedef struct {
+	S32                     pos;        // pixels from first entry to top of list window
+	S32                     target;
+	S32                     drawn;      // pos of last frame drawn
+	S32                     minStep;
+	U64                     nextTime;
+} ScrollAnim;
+
+// Startup phase executed on own thread, timings are relative to process start
+typedef struct {
+	const char              *name;
+	std::function<bool()>   func;
+	pthread_t               thread;
+	bool                    started;
+	std::atomic<bool>       done;
+	bool                    result;
+	U64                     startTime;
+	U64                     endTime;
+} StartupTask;
+
+// Set from SIGUSR1 handler, frame stats are logged from main loop
+static volatile sig_atomic_t frameStatsRequested;
+
+static void FrameStatsSignal(int signal) {
+	frameStatsRequested = 1;
+}
+
+static U64 GetTimeUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *StartupTaskThread(void *ptr) {
+	StartupTask *task = (StartupTask *)ptr;
+
+	task->startTime = GetTimeUs();
+	task->result = task->func();
+	task->endTime = GetTimeUs();
+	task->done = true;
+
+	return nullptr;
+}
+
+static void StartupTaskStart(StartupTask &task, const char *name, std::function<bool()> func) {
+	task.name = name;
+	task.func = func;
+	task.done = false;
+	task.result = false;
+	if (pthread_create(&task.thread, nullptr, StartupTaskThread, &task) == 0) {
+		task.started = true;
+	} else {
+		log->printf("Failed start %s thread, running inline\n", name);
+		StartupTaskThread(&task);
+	}
+}
+
+static bool StartupTaskWait(StartupTask &task) {
+	if (task.started) {
+		pthread_join(task.thread, nullptr);
+		task.started = false;
+	}
+	return task.result;
+}
+
+static void StartupTaskLog(const StartupTask &task, U64 startupTime) {
+	log->printf("Startup: %-8s %8.1f ms -> %8.1f ms (%.1f ms)\n", task.name,
+	            (task.startTime - startupTime) / 1000.0, (task.endTime - startupTime) / 1000.0,
+	            (task.endTime - task.startTime) / 1000.0);
+}
+
+// Sleeps until display has event or timeout expires, completes pending page flips
+static void WaitEvents(Display *display, int timeoutMs) {
+	int fd = display->getEventFd();
+
+	if (fd == -1) {
+		usleep(timeoutMs * 1000);
+		return;
+	}
+
+	struct pollfd fds[1] = { { .fd = fd, .events = POLLIN } };
+	if (poll(fds, 1, timeoutMs) > 0 && (fds[0].revents & POLLIN))
+		display->handleEvents();
+}
+
+// Expects font size already set to the one used for label
+static void MarqueeStart(Marquee &marquee, const std::string &text, int size, const Rect &rect,
+                         S32 baseline, S32 speed, U8 r, U8 g, U8 b) {
+	marquee.text = text;
+	marquee.size = size;
+	marquee.r = r;
+	marquee.g = g;
+	marquee.b = b;
+	marquee.rect = rect;
+	marquee.baseline = baseline;
+	marquee.scroll = 0;
+	marquee.maxScroll = MAX(FontsMeasureText(text) - rect.width, 0);
+	marquee.speed = speed;
+	marquee.nextTime = GetTimeUs() + MARQUEE_PAUSE_US;
+}
+
+static void MarqueeStop(Marquee &marquee) {
+	marquee.text.clear();
+}
+
+static bool MarqueeStep(Marquee &marquee, U64 now) {
+	if (marquee.text.empty() || now < marquee.nextTime)
+		return false;
+
+	if (marquee.scroll >= marquee.maxScroll) {
+		marquee.scroll = 0;
+		marquee.nextTime = now + MARQUEE_PAUSE_US;
+	} else {
+		marquee.scroll = MIN(marquee.scroll + marquee.speed, marquee.maxScroll);
+		marquee.nextTime = now + (marquee.scroll == marquee.maxScroll ? MARQUEE_PAUSE_US : MARQUEE_STEP_US);
+	}
+
+	return true;
+}
+
+static void MarqueeRender(RenderList &list, const Marquee &marquee) {
+	RenderAddTextClipped(list, marquee.text, marquee.size, marquee.rect.x - marquee.scroll, marquee.baseline,
+	                     marquee.r, marquee.g, marquee.b, marquee.rect);
+}
+
+// Frame on screen shows other content, nothing of it is moved
+static void ScrollAnimJump(ScrollAnim &anim, S32 target) {
+	anim.pos = anim.target = anim.drawn = target;
+}
+
+// Distant targets, like selection wrapping around, are not animated
+static void ScrollAnimSet(ScrollAnim &anim, S32 target, S32 rowHeight) {
+	anim.target = target;
+	if (ABS(target - anim.pos) > SCROLL_JUMP_ROWS * rowHeight)
+		ScrollAnimJump(anim, target);
+}
+
+static bool ScrollAnimStep(ScrollAnim &anim, U64 now) {
+	if (anim.pos == anim.target || now < anim.nextTime)
+		return false;
+
+	S32 delta = anim.target - anim.pos;
+	S32 step = MAX(ABS(delta) / 4, anim.minStep);
+	anim.pos += delta > 0 ? MIN(step, delta) : MAX(-step, delta);
+	anim.nextTime = now + SCROLL_STEP_US;
+
+	return true;
+}
+
+// Selection bar is drawn once into overlay plane, moving selection then
+// only moves the plane. Returns false when display has no overlay.
+static bool SelectionBarCreate(Display *display, S32 width, S32 height) {
+	if (display->createOverlay(width, height) == S_FAIL)
+		return false;
+
+	Surface surface = { (U8 *)display->getOverlayPtr(), (U32)width, (U32)height,
+	                    display->getOverlayStride(), PIXEL_FORMAT_ARGB8888 };
+	Rect rect = { 0, 0, width, height };
+	BlitFill(surface, rect, rect, SELECTION_BAR_COLOR);
+	FontsSetSize(height);
+	FontsRenderText(SELECTION_MARKER, surface, rect, width - FontsMeasureText(SELECTION_MARKER),
+	                height * 3 / 4, 0, 255, 255);
+
+	return true;
+}
+
+// Buffer holding several screens of rows is tried first, drivers often limit
+// framebuffer height. Returns false when display has no plane for it.
+static bool ScrollLayerCreate(ScrollLayer &layer, Display *display, const Rect &window, S32 rowHeight) {
+	for (int rows : { SCROLL_LAYER_ROWS, LIST_ROWS * 2 }) {
+		if (display->createScrollLayer(window, rows * rowHeight) == S_FAIL)
+			continue;
+		layer.window = window;
+		layer.rowHeight = rowHeight;
+		layer.rows = rows;
+		layer.base = 0;
+		layer.content.assign(rows, RenderList());
+		layer.valid.assign(rows, false);
+		return true;
+	}
+
+	return false;
+}
+
+// Moves window to list position in pixels, buffer is rebased around first
+// visible entry when entries needed are not inside. Returns buffer row of entry.
+static int ScrollLayerScroll(ScrollLayer &layer, Display *display, S32 pos, int numEntries) {
+	int first = pos / layer.rowHeight;
+	// window between rows shows one more
+	int last = MIN(first + LIST_ROWS + (pos % layer.rowHeight ? 1 : 0), numEntries);
+
+	if (first < layer.base || last > layer.base + layer.rows) {
+		layer.base = CLIP(first - (layer.rows - LIST_ROWS) / 2, 0, MAX(numEntries - layer.rows, 0));
+		layer.valid.assign(layer.rows, false);
+	}
+	display->setScrollLayerOffset(pos - layer.base * layer.rowHeight);
+
+	return first - layer.base;
+}
+
+// Takes items of row, list is left empty for next row
+static void ScrollLayerDrawRow(ScrollLayer &layer, Display *display, int row, RenderList &items) {
+	if (row < 0 || row >= layer.rows || (layer.valid[row] && RenderListEqual(layer.content[row], items))) {
+		items.clear();
+		return;
+	}
+
+	Surface surface = { (U8 *)display->getScrollLayerPtr(), (U32)layer.window.width,
+	                    (U32)(layer.rows * layer.rowHeight), display->getScrollLayerStride(),
+	                    PIXEL_FORMAT_ARGB8888 };
+	Rect rect = { 0, row * layer.rowHeight, layer.window.width, layer.rowHeight };
+	RenderDrawRect(items, surface, rect);
+	display->addScrollLayerDamage(rect);
+	layer.content[row].swap(items);
+	layer.valid[row] = true;
+	items.clear();
+}
+
+static std::string EntryText(const Fs::FsEntry &entry) {
+	if (entry.type == Fs::FsEntryType::FsDirectory)
+		return std::string("[ ") + entry.name + " ]";
+
+	return fs::path(entry.name).stem();
+}
+
 int GuiRun(int argc, char *argv[]) {
 	int option;
 	const char *dirName;
@@ -39,19 +317,95 @@ int GuiRun(int argc, char *argv[]) {
 	std::string lastPath;
 	int lastSelection = 0;
 	int scale = 1;
-	std::vector<Fs::FsEntry> entries;
+	std::vector<Fs::FsEntry> entries, listingEntries;
 	bool guiUpdate = true;
 	int selection = 0;
 	int parentSelection = 0;
 	int offset = 0;
 	int parentOffset = 0;
+	U64 startupTime = GetTimeUs();
+	StartupTask displayTask{}, fontsTask{}, remoteTask{}, listingTask{};
+	bool listingReady = false;
+	bool firstFrame = true;
+	Marquee marquee{};
+	RenderList renderList, lastRenderList;
+	bool mailbox = false;
+	bool legacyDrm = false;
+	DISPLAY_SHADOW shadowMode = DISPLAY_SHADOW_AUTO;
+	PIXEL_FORMAT pixelFormat = PIXEL_FORMAT_ARGB8888;
+	bool scaledRender = false;
+	bool tileDiff = false;
+	bool selectionBar = false;
+	ScrollLayer scrollLayer{};
+	ScrollAnim scroll{};
+	S32 listWidth = 0;
+	bool headless = false;
+	int headlessFrames = 0;        // headless run ends after that many frames, 0 unlimited
+	std::string headlessKeys;      // synthetic key presses, run ends when GUI idles after them
+	size_t headlessKeyPos = 0;
+	int framesRendered = 0;
+	int refreshRate = 60;
+	const char *dumpPattern = nullptr;
+	int renderThreads = 0;
+	bool restoreSnapshot = false;
 
 	if (CreateLogs() == S_FAIL) {
 		return -1;
 	}
 
-	while ((option = getopt(argc, argv, ":")) != -1) {
+	while ((option = getopt(argc, argv, ":smlb:f:uHn:k:R:D:j:S:L:t")) != -1) {
 		switch (option) {
+		case 's':
+			FontsSetSdfMode(true);
+			break;
+		case 'm':
+			mailbox = true;
+			break;
+		case 'l':
+			legacyDrm = true;
+			break;
+		case 'b':
+			if (strcmp(optarg, "on") == 0)
+				shadowMode = DISPLAY_SHADOW_ON;
+			else if (strcmp(optarg, "off") == 0)
+				shadowMode = DISPLAY_SHADOW_OFF;
+			break;
+		case 'f':
+			if (strcmp(optarg, "xrgb") == 0)
+				pixelFormat = PIXEL_FORMAT_XRGB8888;
+			else if (strcmp(optarg, "rgb565") == 0)
+				pixelFormat = PIXEL_FORMAT_RGB565;
+			break;
+		case 'u':
+			scaledRender = true;
+			break;
+		case 'H':
+			headless = true;
+			break;
+		case 'n':
+			headlessFrames = MAX(atoi(optarg), 0);
+			break;
+		case 'k':
+			headlessKeys = optarg;
+			break;
+		case 'R':
+			refreshRate = atoi(optarg);
+			break;
+		case 'D':
+			dumpPattern = optarg;
+			break;
+		case 'j':
+			renderThreads = atoi(optarg);
+			break;
+		case 'S':
+			SnapshotsSetBudget(CLIP(atoi(optarg), 0, 1024) * 1024 * 1024);
+			break;
+		case 'L':
+			LabelsSetBudget(CLIP(atoi(optarg), 0, 1024) * 1024 * 1024);
+			break;
+		case 't':
+			tileDiff = true;
+			break;
 		default:
 			break;
 		}
@@ -74,43 +428,124 @@ int GuiRun(int argc, char *argv[]) {
 	fileSystem.AddMediaExtension(".mov");
 	fileSystem.AddMediaExtension(".flv");
 
+	// Independent phases run in parallel, first frame only needs display and fonts.
+	// Display stays on main thread as SDL2 expects video calls from there.
+	StartupTaskStart(fontsTask, "fonts", []() {
+		return FontsInit();
+	});
+	StartupTaskStart(remoteTask, "remote", []() {
+		return RemoteInit() == 0;
+	});
+	// task owns fileSystem and fills its own vector until it is joined
+	StartupTaskStart(listingTask, "listing", [&]() {
+		if (!lastPath.empty())
+			fileSystem.EnterDirectory(lastPath);
+		fileSystem.GetMediaEntries(listingEntries);
+		return true;
+	});
+
+	displayTask.name = "display";
+	displayTask.startTime = GetTimeUs();
+	if (headless) {
+		DisplayHeadless *displayHeadless = (DisplayHeadless *)CreateDisplay(DISPLAY_HEADLESS);
+		displayHeadless->setMode(1920, 1080, refreshRate);
+		// pattern ending with .ppm selects PPM, anything else raw ARGB8888
+		if (dumpPattern) {
+			const char *ext = strrchr(dumpPattern, '.');
+			displayHeadless->setDump(dumpPattern, ext && strcmp(ext, ".ppm") == 0 ?
+			                         HEADLESS_DUMP_PPM : HEADLESS_DUMP_RAW);
+		}
+		display = displayHeadless;
+	} else {
 #if defined(BUILD_SDL2)
-	display = CreateDisplay(DISPLAY_SDL2);
+		display = CreateDisplay(DISPLAY_SDL2);
 #else
-	display = CreateDisplay(DISPLAY_DRM);
+		display = CreateDisplay(legacyDrm ? DISPLAY_DRM : DISPLAY_DRM_ATOMIC);
 #endif
+	}
 	if (display == nullptr) {
 		log->printf("Failed create display!\n");
 		goto end;
 	}
+	display->setMailbox(mailbox);
+	display->setShadowMode(shadowMode);
+	display->setPixelFormat(pixelFormat);
+	display->setScaledRender(scaledRender);
+	display->setTileDiff(tileDiff);
 	if (display->init() == S_FAIL) {
 		log->printf("Failed init display!\n");
 		goto end;
 	}
+	displayTask.endTime = GetTimeUs();
 
-	if (RemoteInit() != 0) {
+	if (!StartupTaskWait(remoteTask)) {
 		log->printf("Failed init remote controller!\n");
-		goto end;
+		// headless runs are driven without input device
+		if (!headless)
+			goto end;
 	}
 
-	if (!FontsInit()) {
+	if (!StartupTaskWait(fontsTask)) {
 		log->printf("Failed init fonts!\n");
 		goto end;
 	}
 
+	BlitInit(BLIT_KERNEL_AUTO);
+	log->printf("Using %s blit kernels\n", BlitGetKernelName());
+	RenderInitThreads(renderThreads);
+
+	// stays 1 with scaled render, display upscales whole frame instead
 	if (display->getBufferWidth() > 1920)
 		scale = 2;
 
-	if (!lastPath.empty())
-		fileSystem.EnterDirectory(lastPath);
+	listWidth = display->getBufferWidth() - (80 + 80) * scale;
+	scroll.minStep = 2 * scale;
+	selectionBar = SelectionBarCreate(display, listWidth, 30 * scale);
+	log->printf("Selection bar %s\n", selectionBar ? "on overlay plane" : "rendered into frame");
+	scrollLayer.enabled = ScrollLayerCreate(scrollLayer, display, { 80 * scale, 150 * scale - 30 * scale * 3 / 4,
+	                                        listWidth, LIST_ROWS * 30 * scale }, 30 * scale);
+	if (scrollLayer.enabled)
+		log->printf("List rows on scroll layer, %d rows buffered\n", scrollLayer.rows);
+	else
+		log->printf("List rows rendered into frame\n");
 
-	selection = lastSelection;
-	fileSystem.GetMediaEntries(entries);
-	if (entries.size() == 0) {
-		parentOffset = parentSelection = selection = lastSelection = -1;
-	}
+	signal(SIGUSR1, FrameStatsSignal);
+
+	selection = parentOffset = parentSelection = -1;
 	do {
 		int inputKey = RemoteRead();
+
+		if (frameStatsRequested) {
+			frameStatsRequested = 0;
+			display->logFrameStats();
+			if (headless)
+				((DisplayHeadless *)display)->logStats();
+		}
+
+		// next synthetic key once previous one finished scrolling
+		if (headless && inputKey == -1 && listingReady && headlessKeyPos < headlessKeys.size() &&
+		    scroll.pos == scroll.target)
+			inputKey = headlessKeys[headlessKeyPos++];
+
+		if (!listingReady) {
+			if (!listingTask.done) {
+				inputKey = -1;
+			} else {
+				StartupTaskWait(listingTask);
+				StartupTaskLog(listingTask, startupTime);
+				FontsFlushMeasureCache();
+				entries.swap(listingEntries);
+				listingReady = true;
+				selection = lastSelection;
+				if (entries.size() == 0) {
+					parentOffset = parentSelection = selection = lastSelection = -1;
+				} else {
+					parentOffset = parentSelection = 0;
+				}
+				guiUpdate = true;
+			}
+		}
+
 		switch (inputKey) {
 		case 'p':
 		case 'r':
@@ -119,23 +554,36 @@ int GuiRun(int argc, char *argv[]) {
 				break;
 			auto &entry = entries[selection];
 			if (entry.type == Fs::FsEntryType::FsDirectory && (inputKey == 'e' || inputKey == 'r')) {
+				std::string path = fileSystem.CurrentPath();
+				U64 generation = fileSystem.ListingGeneration();
 				if (fileSystem.EnterDirectory(entry.name)) {
+					// frame on screen is kept for returning back with 'l'
+					SnapshotsStore(path, offset, selection, generation, lastRenderList, display);
 					fileSystem.GetMediaEntries(entries);
+					SnapshotsInvalidate(fileSystem.CurrentPath(), fileSystem.ListingGeneration());
+					FontsFlushMeasureCache();
 					parentSelection = selection;
 					parentOffset = offset;
 					offset = selection = 0;
+					ScrollAnimJump(scroll, 0);
 				}
 				guiUpdate = true;
 				break;
 			}
 			if (entry.type == Fs::FsEntryType::FsFile && (inputKey == 'e' || inputKey == 'p')) {
-				display->deinit();
+				FontsSaveCache();
+				display->suspend();
 				RemoteClose();
 				std::string command = "mpv \"";
 				command += (char *)(fs::path(fileSystem.CurrentPath() + "/" + entry.name + "\"").c_str());
 				system(command.c_str());
-				display->init();
+				display->resume();
 				RemoteInit();
+				// planes are lost when display had to reinitialize
+				if (selectionBar && !display->getOverlayPtr())
+					selectionBar = SelectionBarCreate(display, listWidth, 30 * scale);
+				if (scrollLayer.enabled && !display->getScrollLayerPtr())
+					scrollLayer.enabled = ScrollLayerCreate(scrollLayer, display, scrollLayer.window, scrollLayer.rowHeight);
 			}
 			guiUpdate = true;
 			break;
@@ -143,6 +591,7 @@ int GuiRun(int argc, char *argv[]) {
 		case 'l': {
 			if (selection < 0) {
 				fileSystem.GetMediaEntries(entries);
+				FontsFlushMeasureCache();
 				if (entries.size() == 0) {
 					guiUpdate = true;
 					break;
@@ -151,9 +600,13 @@ int GuiRun(int argc, char *argv[]) {
 			}
 			if (fileSystem.ExitDirectory()) {
 				fileSystem.GetMediaEntries(entries);
+				SnapshotsInvalidate(fileSystem.CurrentPath(), fileSystem.ListingGeneration());
+				FontsFlushMeasureCache();
 				selection = parentSelection;
 				offset = parentOffset;
 				parentOffset = parentSelection = 0;
+				restoreSnapshot = true;
+				ScrollAnimJump(scroll, offset * 30 * scale);
 			}
 			guiUpdate = true;
 			break;
@@ -206,75 +659,189 @@ int GuiRun(int argc, char *argv[]) {
 			break;
 		}
 
+		if (scroll.target != offset * 30 * scale)
+			ScrollAnimSet(scroll, offset * 30 * scale, 30 * scale);
+		// steps move rows in back buffer, when it cannot be read each one repaints whole list
+		if (!scrollLayer.enabled && scroll.pos != scroll.target && !display->isBufferReadable())
+			ScrollAnimJump(scroll, scroll.target);
+		if (ScrollAnimStep(scroll, GetTimeUs()))
+			guiUpdate = true;
+
+		if (MarqueeStep(marquee, GetTimeUs()))
+			guiUpdate = true;
+
 		if (!guiUpdate) {
-			usleep(10000);
+			if (headless && (headlessFrames || !headlessKeys.empty()) && listingReady &&
+			    headlessKeyPos == headlessKeys.size()) {
+				log->printf("Headless run done after %d frames\n", framesRendered);
+				goto end;
+			}
+			WaitEvents(display, 10);
 			continue;
 		}
 
-		display->clear();
+		renderList.clear();
 
-		FontsSetSize(50 * scale);
 		std::string title = "--== Media Player ==--";
-		FontsRenderText(title.c_str(),
-		                (U8 *)display->getBufferPtr(),
-		                80 * scale,
-		                80 * scale,
-		                display->getBufferStride(),
-		                0, 255, 0);
+		RenderAddText(renderList, title, 50 * scale, 80 * scale, 80 * scale, 0, 255, 0);
 
 		FontsSetSize(30 * scale);
-		std::string pathStr = "* ";
-		pathStr += fileSystem.CurrentPath() + "/ *";
-		FontsRenderText(pathStr.c_str(),
-		                (U8 *)display->getBufferPtr(),
-		                700 * scale,
-		                80 * scale,
-		                display->getBufferStride(),
-		                255, 255, 0);
+		std::string pathStr;
+		if (listingReady) {
+			pathStr = "* " + fileSystem.CurrentPath() + "/ *";
+			pathStr = FontsTruncateText(pathStr, display->getBufferWidth() - (700 + 80) * scale);
+			RenderAddText(renderList, pathStr, 30 * scale, 700 * scale, 80 * scale, 255, 255, 0);
+		}
 
 		if (offset > 0) {
-			FontsRenderText("^^^",
-			                (U8 *)display->getBufferPtr(),
-			                80 * scale,
-			                120 * scale,
-			                display->getBufferStride(),
-			               255, 0, 0);
+			RenderAddText(renderList, "^^^", 30 * scale, 80 * scale, 120 * scale, 255, 0, 0);
 		}
 
-		int num = entries.size();
-		if (num > 30)
-			num = 30;
-		for (int index = offset, drawIndex = 0; index < (offset + num); index++, drawIndex++) {
+		// list between two positions shows part of one more row at bottom
+		S32 rowHeight = 30 * scale;
+		Rect listRect = { 80 * scale, 150 * scale - rowHeight * 3 / 4, listWidth, LIST_ROWS * rowHeight };
+		int first = scroll.pos / rowHeight;
+		S32 phase = scroll.pos % rowHeight;
+		int rowsShown = LIST_ROWS + (phase ? 1 : 0);
+		int num = CLIP((int)entries.size() - first, 0, rowsShown);
+		// with selection bar marker column stays free, rows do not change on selection move
+		S32 markerWidth = FontsMeasureText(SELECTION_MARKER);
+		S32 textWidth = selectionBar ? listWidth - markerWidth : listWidth;
+		bool marqueeActive = false;
+		bool barVisible = false;
+		S32 barY = 0;
+		// rows on scroll layer are placed in its buffer, window is moved to position
+		RenderList rowList;
+		int firstRow = 0;
+		S32 rowX = 80 * scale;
+		Rect rowClip = listRect;
+		if (scrollLayer.enabled) {
+			firstRow = ScrollLayerScroll(scrollLayer, display, scroll.pos, entries.size());
+			rowX = 0;
+			rowClip = { 0, 0, listWidth, scrollLayer.rows * rowHeight };
+		}
+		for (int index = first, drawIndex = 0; index < (first + num); index++, drawIndex++) {
 			auto &entry = entries[index];
-			if (entry.type == Fs::FsEntryType::FsDirectory) {
-				pathStr = std::string("[ ") + entry.name + " ]";
+			S32 baseline = 150 * scale + (rowHeight * drawIndex) - phase;
+			RenderList &list = scrollLayer.enabled ? rowList : renderList;
+			S32 rowBaseline = scrollLayer.enabled ? (firstRow + drawIndex) * rowHeight + rowHeight * 3 / 4 : baseline;
+			pathStr = EntryText(entry);
+			if (selection == index) {
+				S32 nameWidth = listWidth - markerWidth;
+				U8 red = selectionBar ? 255 : 0;
+				barVisible = true;
+				barY = baseline - rowHeight * 3 / 4;
+				if (FontsMeasureText(pathStr) > nameWidth) {
+					Rect rect = RectIntersect({ rowX, rowBaseline - rowHeight * 3 / 4, nameWidth, rowHeight }, rowClip);
+					if (marquee.text != pathStr)
+						MarqueeStart(marquee, pathStr, 30 * scale, rect, rowBaseline, scale, red, 255, 255);
+					// row moves while list scrolls, text keeps its marquee position
+					marquee.rect = rect;
+					marquee.baseline = rowBaseline;
+					MarqueeRender(list, marquee);
+					if (!selectionBar)
+						RenderAddTextClipped(list, SELECTION_MARKER, 30 * scale, rowX + nameWidth, rowBaseline,
+						                     0, 255, 255, rowClip);
+					marqueeActive = true;
+				} else {
+					if (!selectionBar)
+						pathStr += SELECTION_MARKER;
+					RenderAddTextClipped(list, pathStr, 30 * scale, rowX, rowBaseline, selectionBar ? 255 : 0, 255, 255, rowClip);
+				}
 			} else {
-				pathStr = fs::path(entry.name).stem();
+				pathStr = FontsTruncateText(pathStr, textWidth);
+				RenderAddTextClipped(list, pathStr, 30 * scale, rowX, rowBaseline, 255, 255, 255, rowClip);
 			}
-			if (selection == index)
-				pathStr += " <---";
-			FontsRenderText(pathStr.c_str(),
-			                (U8 *)display->getBufferPtr(),
-			                80 * scale,
-			                150 * scale + (30 * scale * drawIndex),
-			                display->getBufferStride(),
-			                selection == index ? 0 : 255, 255, 255);
+			if (scrollLayer.enabled)
+				ScrollLayerDrawRow(scrollLayer, display, firstRow + drawIndex, rowList);
 		}
+		if (scrollLayer.enabled) {
+			for (int drawIndex = num; drawIndex < rowsShown; drawIndex++)
+				ScrollLayerDrawRow(scrollLayer, display, firstRow + drawIndex, rowList);
+			// rows next to window are drawn ahead, next scroll step is then only plane update
+			for (int index : { first - 1, first + rowsShown }) {
+				if (index < 0 || index >= (int)entries.size())
+					continue;
+				int row = index - scrollLayer.base;
+				pathStr = FontsTruncateText(EntryText(entries[index]), textWidth);
+				RenderAddTextClipped(rowList, pathStr, 30 * scale, 0, row * rowHeight + rowHeight * 3 / 4,
+				                     255, 255, 255, rowClip);
+				ScrollLayerDrawRow(scrollLayer, display, row, rowList);
+			}
+		}
+		if (!marqueeActive)
+			MarqueeStop(marquee);
 
 		if (entries.size() > 30 && (entries.size() - offset) > 30) {
-			FontsRenderText("v v v",
-			                (U8 *)display->getBufferPtr(),
-			                80 * scale,
-			                150 * scale + (30 * scale * 30),
-			                display->getBufferStride(),
-			                255, 0, 0);
+			RenderAddText(renderList, "v v v", 30 * scale, 80 * scale, 150 * scale + (30 * scale * 30), 255, 0, 0);
+		}
+
+		if (!listingReady) {
+			RenderAddText(renderList, "Loading...", 30 * scale, 80 * scale, 150 * scale, 255, 255, 255);
 		}
 
-		display->flip();
+		if (selectionBar)
+			display->setOverlay(80 * scale, barY, barVisible && listingReady);
+
+		// returning to view shown before copies its frame, only items differing are drawn
+		std::shared_ptr<Snapshot> snapshot;
+		if (restoreSnapshot) {
+			snapshot = SnapshotsGet(fileSystem.CurrentPath(), offset, selection, fileSystem.ListingGeneration(), display);
+			restoreSnapshot = false;
+		}
+
+		// rows already on screen are moved in place, only strip scrolled in is drawn.
+		// When they cannot be moved list is repainted and rest of animation skipped.
+		bool scrollMoved = scrollLayer.enabled || scroll.drawn == scroll.pos ||
+		                   RenderScroll(lastRenderList, listRect, scroll.drawn - scroll.pos, display);
+		scroll.drawn = scroll.pos;
+
+		// only regions where draw list changed are cleared and redrawn
+		RenderAddDamage(lastRenderList, renderList, display);
+		if (snapshot ? RenderDrawFrom(renderList, snapshot->surface, snapshot->list, display) :
+		               RenderDraw(renderList, display)) {
+			display->flip();
+		} else if ((selectionBar || scrollLayer.enabled) && display->commitPlanes() == S_FAIL) {
+			log->printf("Failed update planes, rendering selection bar and list into frame\n");
+			display->destroyOverlay();
+			display->destroyScrollLayer();
+			selectionBar = scrollLayer.enabled = false;
+			continue;
+		}
+		lastRenderList.swap(renderList);
 		guiUpdate = false;
+		if (!scrollMoved) {
+			ScrollAnimJump(scroll, scroll.target);
+			guiUpdate = true;
+		}
+
+		if (firstFrame) {
+			StartupTaskLog(displayTask, startupTime);
+			StartupTaskLog(fontsTask, startupTime);
+			StartupTaskLog(remoteTask, startupTime);
+			log->printf("Startup: first frame at %.1f ms\n", (GetTimeUs() - startupTime) / 1000.0);
+			firstFrame = false;
+		}
+
+		framesRendered++;
+		if (headless && headlessFrames && framesRendered >= headlessFrames) {
+			log->printf("Headless run done after %d frames\n", framesRendered);
+			goto end;
+		}
 	} while (true);
 
 end:
+	StartupTaskWait(fontsTask);
+	StartupTaskWait(remoteTask);
+	StartupTaskWait(listingTask);
+	if (display)
+		display->logFrameStats();
+	RenderDeinitThreads();
+	SnapshotsFlush();
+	renderList.clear();
+	lastRenderList.clear();
+	LabelsFlush();
+	FontsSaveCache();
 	FontsDeinit();
 	RemoteClose();
 	delete display;
@@ -0,0 +1,366 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "basetypes.h"
+#include "logs.h"
+#include "render.h"
+
+namespace MpvGui {
+
+#define RENDER_MAX_THREADS       8
+#define RENDER_MIN_BAND_PIXELS   (128 * 1024)   // smaller repaints are drawn inline
+
+static const Rect noClip = { -0x10000000, -0x10000000, 0x20000000, 0x20000000 };
+
+// Time spent clearing and drawing items, us
+typedef struct {
+	U64                     clear;
+	U64                     text;
+} DrawTimes;
+
+// Repainted area is split into horizontal bands, one per thread. Each worker draws
+// repaint region clipped to own band, bands do not overlap so nothing is locked
+// while drawing. Caller draws first band itself.
+typedef struct {
+	int                     numThreads;      // including caller
+	pthread_t               threads[RENDER_MAX_THREADS];
+	pthread_mutex_t         lock;
+	pthread_cond_t          startCond;
+	pthread_cond_t          doneCond;
+	U32                     generation;      // bumped for each frame handed to workers
+	int                     pending;         // workers not yet done with frame
+	bool                    quit;
+
+	const RenderList        *list;
+	const std::vector<Rect> *region;
+	Surface                 surface;
+	Rect                    bounds;          // of region, split into bands
+	int                     numBands;
+	DrawTimes               bandTimes[RENDER_MAX_THREADS];
+} RenderPool;
+
+static RenderPool pool = { 1 };
+
+void RenderAddTextClipped(RenderList &list, const std::string &text, int size, S32 pos_x, S32 pos_y,
+                          U8 r, U8 g, U8 b, const Rect &clip) {
+	RenderItem item;
+
+	item.label = LabelsGet(text, size, r, g, b);
+	if (!item.label)
+		return;
+	item.x = pos_x;
+	item.y = pos_y;
+	item.clip = clip;
+	item.bounds = RectIntersect(clip, { pos_x - item.label->originX, pos_y - item.label->originY,
+	                                    (S32)item.label->width, (S32)item.label->height });
+	list.push_back(item);
+}
+
+void RenderAddText(RenderList &list, const std::string &text, int size, S32 pos_x, S32 pos_y,
+                   U8 r, U8 g, U8 b) {
+	RenderAddTextClipped(list, text, size, pos_x, pos_y, r, g, b, noClip);
+}
+
+static bool itemEqual(const RenderItem &a, const RenderItem &b) {
+	return a.label == b.label && a.x == b.x && a.y == b.y && RectEqual(a.clip, b.clip);
+}
+
+static bool listContains(const RenderList &list, const RenderItem &item) {
+	for (auto &other : list) {
+		if (itemEqual(other, item))
+			return true;
+	}
+	return false;
+}
+
+// Lists are built in same order each frame, so items are compared by position
+// in list first. Scrolled list shifts its rows, those are found by search.
+static void getDamage(const RenderList &oldList, const RenderList &newList, std::vector<Rect> &rects) {
+	int count = MAX(oldList.size(), newList.size());
+
+	for (int i = 0; i < count; i++) {
+		if (i < oldList.size() && i < newList.size() && itemEqual(oldList[i], newList[i]))
+			continue;
+		if (i < oldList.size() && !RectIsEmpty(oldList[i].bounds) && !listContains(newList, oldList[i]))
+			rects.push_back(oldList[i].bounds);
+		if (i < newList.size() && !RectIsEmpty(newList[i].bounds) && !listContains(oldList, newList[i]))
+			rects.push_back(newList[i].bounds);
+	}
+}
+
+void RenderAddDamage(const RenderList &oldList, const RenderList &newList, Display *display) {
+	std::vector<Rect> rects;
+
+	getDamage(oldList, newList, rects);
+	for (auto &rect : rects)
+		display->addDamage(rect);
+}
+
+bool RenderListEqual(const RenderList &a, const RenderList &b) {
+	if (a.size() != b.size())
+		return false;
+
+	for (int i = 0; i < a.size(); i++) {
+		if (!itemEqual(a[i], b[i]))
+			return false;
+	}
+
+	return true;
+}
+
+// Moves pixels of rect in back buffer dy rows and shifts items of list lying in it
+// along, so list keeps describing buffer. Only uncovered strip and items moved
+// partly are damaged. Returns false when buffer can not be read back.
+bool RenderScroll(RenderList &list, const Rect &rect, S32 dy, Display *display) {
+	Surface surface = { (U8 *)display->getBufferPtr(), display->getBufferWidth(),
+	                    display->getBufferHeight(), display->getBufferStride(),
+	                    display->getBufferFormat() };
+
+	if (dy == 0)
+		return true;
+	if (!display->isBufferReadable() || ABS(dy) >= rect.height)
+		return false;
+
+	U64 startTime = DisplayGetTimeUs();
+	BlitMove(surface, rect, dy);
+	display->addDrawTimes(DisplayGetTimeUs() - startTime, 0);
+	display->addMovedDamage(rect);
+	if (dy > 0)
+		display->addDamage({ rect.x, rect.y, rect.width, dy });
+	else
+		display->addDamage({ rect.x, rect.y + rect.height + dy, rect.width, -dy });
+
+	for (auto &item : list) {
+		Rect inside = RectIntersect(item.bounds, rect);
+		if (RectIsEmpty(inside))
+			continue;
+		Rect moved = RectIntersect({ item.bounds.x, item.bounds.y + dy, item.bounds.width, item.bounds.height }, rect);
+		if (!RectEqual(inside, item.bounds)) {
+			// crossing rect edge, part outside stayed in place
+			display->addDamage(item.bounds);
+			display->addDamage(moved);
+			continue;
+		}
+		const Label *label = item.label.get();
+		item.y += dy;
+		item.bounds = RectIntersect(item.clip, { item.x - label->originX, item.y - label->originY,
+		                                         (S32)label->width, (S32)label->height });
+		// part clipped before was never drawn, or part moved out of rect was lost
+		if (!RectEqual(item.bounds, moved))
+			display->addDamage(RectUnion(item.bounds, moved));
+	}
+
+	return true;
+}
+
+static void drawRect(const RenderList &list, const Surface &surface, const Rect &rect, DrawTimes *times) {
+	const BlitOps *ops = BlitGetOps(surface.format);
+	U64 startTime = times ? DisplayGetTimeUs() : 0;
+
+	ops->fill(surface, rect, rect, 0);
+	U64 clearTime = times ? DisplayGetTimeUs() : 0;
+	for (auto &item : list) {
+		Rect clip = RectIntersect(rect, item.clip);
+		if (RectIsEmpty(RectIntersect(clip, item.bounds)))
+			continue;
+		const Label *label = item.label.get();
+		ops->image(surface, clip, item.x - label->originX, item.y - label->originY,
+		           label->pixels, label->width, label->width, label->height);
+	}
+	if (times) {
+		times->clear += clearTime - startTime;
+		times->text += DisplayGetTimeUs() - clearTime;
+	}
+}
+
+void RenderDrawRect(const RenderList &list, const Surface &surface, const Rect &rect) {
+	drawRect(list, surface, rect, nullptr);
+}
+
+static void drawBand(int band) {
+	const Rect &bounds = pool.bounds;
+	S32 y1 = bounds.y + bounds.height * band / pool.numBands;
+	S32 y2 = bounds.y + bounds.height * (band + 1) / pool.numBands;
+	Rect bandRect = { bounds.x, y1, bounds.width, y2 - y1 };
+
+	pool.bandTimes[band] = {};
+	for (auto &rect : *pool.region) {
+		Rect clip = RectIntersect(rect, bandRect);
+		if (!RectIsEmpty(clip))
+			drawRect(*pool.list, pool.surface, clip, &pool.bandTimes[band]);
+	}
+}
+
+static void *renderThread(void *ptr) {
+	int band = (int)(intptr_t)ptr;
+	U32 generation = 0;
+
+	pthread_mutex_lock(&pool.lock);
+	while (true) {
+		while (!pool.quit && pool.generation == generation)
+			pthread_cond_wait(&pool.startCond, &pool.lock);
+		if (pool.quit)
+			break;
+		generation = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+
+		if (band < pool.numBands)
+			drawBand(band);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.pending == 0)
+			pthread_cond_signal(&pool.doneCond);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return nullptr;
+}
+
+void RenderInitThreads(int count) {
+	RenderDeinitThreads();
+
+	if (count <= 0)
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+	count = CLIP(count, 1, RENDER_MAX_THREADS);
+
+	pthread_mutex_init(&pool.lock, nullptr);
+	pthread_cond_init(&pool.startCond, nullptr);
+	pthread_cond_init(&pool.doneCond, nullptr);
+	pool.generation = 0;
+	pool.quit = false;
+	pool.numThreads = 1;
+	for (int i = 1; i < count; i++) {
+		if (pthread_create(&pool.threads[i], nullptr, renderThread, (void *)(intptr_t)i) != 0) {
+			log->printf("RenderInitThreads(): Failed create render thread\n");
+			break;
+		}
+		pool.numThreads++;
+	}
+	log->printf("Rendering with %d thread%s\n", pool.numThreads, pool.numThreads > 1 ? "s" : "");
+}
+
+void RenderDeinitThreads() {
+	if (pool.numThreads <= 1)
+		return;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.startCond);
+	pthread_mutex_unlock(&pool.lock);
+	for (int i = 1; i < pool.numThreads; i++)
+		pthread_join(pool.threads[i], nullptr);
+	pthread_cond_destroy(&pool.doneCond);
+	pthread_cond_destroy(&pool.startCond);
+	pthread_mutex_destroy(&pool.lock);
+	pool.numThreads = 1;
+}
+
+// Clears and redraws only repaint region of back buffer, returns false when nothing changed
+bool RenderDraw(const RenderList &list, Display *display) {
+	std::vector<Rect> region;
+	Surface surface = { (U8 *)display->getBufferPtr(), display->getBufferWidth(),
+	                    display->getBufferHeight(), display->getBufferStride(),
+	                    display->getBufferFormat() };
+	Rect bounds = { 0, 0, 0, 0 };
+	U32 pixels = 0;
+
+	display->getRepaintRegion(region);
+	if (region.empty())
+		return false;
+
+	for (auto &rect : region) {
+		bounds = RectUnion(bounds, rect);
+		pixels += rect.width * rect.height;
+	}
+
+	if (pool.numThreads == 1 || pixels < RENDER_MIN_BAND_PIXELS * 2) {
+		DrawTimes times = {};
+		for (auto &rect : region)
+			drawRect(list, surface, rect, &times);
+		display->addDrawTimes(times.clear, times.text);
+		return true;
+	}
+
+	// workers only read shared state between start and done signals
+	pthread_mutex_lock(&pool.lock);
+	pool.list = &list;
+	pool.region = &region;
+	pool.surface = surface;
+	pool.bounds = bounds;
+	pool.numBands = MIN(pool.numThreads, (int)(pixels / RENDER_MIN_BAND_PIXELS));
+	pool.pending = pool.numThreads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.startCond);
+	pthread_mutex_unlock(&pool.lock);
+
+	drawBand(0);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.pending > 0)
+		pthread_cond_wait(&pool.doneCond, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+
+	// slowest band is what frame waited for
+	DrawTimes times = {};
+	for (int band = 0; band < pool.numBands; band++) {
+		times.clear = MAX(times.clear, pool.bandTimes[band].clear);
+		times.text = MAX(times.text, pool.bandTimes[band].text);
+	}
+	display->addDrawTimes(times.clear, times.text);
+
+	return true;
+}
+
+// Repaint region is copied from earlier frame, only items differing from
+// list that frame was drawn from are drawn over it
+bool RenderDrawFrom(const RenderList &list, const Surface &frame, const RenderList &frameList, Display *display) {
+	std::vector<Rect> region, changed;
+	Surface surface = { (U8 *)display->getBufferPtr(), display->getBufferWidth(),
+	                    display->getBufferHeight(), display->getBufferStride(),
+	                    display->getBufferFormat() };
+	const BlitOps *ops = BlitGetOps(surface.format);
+
+	display->getRepaintRegion(region);
+	if (region.empty())
+		return false;
+
+	// copy is reported as clear, it replaces clearing region
+	DrawTimes times = {};
+	getDamage(frameList, list, changed);
+	for (auto &rect : region) {
+		U64 startTime = DisplayGetTimeUs();
+		ops->copy(surface, frame, rect);
+		times.clear += DisplayGetTimeUs() - startTime;
+		for (auto &change : changed) {
+			Rect clip = RectIntersect(rect, change);
+			if (!RectIsEmpty(clip))
+				drawRect(list, surface, clip, &times);
+		}
+	}
+	display->addDrawTimes(times.clear, times.text);
+
+	return true;
+}
+
+} // namespace
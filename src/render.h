@@ -0,0 +1,65 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <string>
+#include <memory>
+#include <vector>
+
+#include "basetypes.h"
+#include "display_base.h"
+#include "labels.h"
+
+namespace MpvGui {
+
+// Label placed on screen, bounds cover its visible pixels
+typedef struct {
+	std::shared_ptr<Label>  label;
+	S32                     x;
+	S32                     y;
+	Rect                    clip;
+	Rect                    bounds;
+} RenderItem;
+
+typedef std::vector<RenderItem> RenderList;
+
+void RenderAddText(RenderList &list, const std::string &text, int size, S32 pos_x, S32 pos_y,
+                   U8 r, U8 g, U8 b);
+void RenderAddTextClipped(RenderList &list, const std::string &text, int size, S32 pos_x, S32 pos_y,
+                          U8 r, U8 g, U8 b, const Rect &clip);
+void RenderAddDamage(const RenderList &oldList, const RenderList &newList, Display *display);
+bool RenderListEqual(const RenderList &a, const RenderList &b);
+// Moves rect of back buffer dy rows and shifts items of list inside it along,
+// list is one drawn into buffer. Fails when buffer can not be read back.
+bool RenderScroll(RenderList &list, const Rect &rect, S32 dy, Display *display);
+// Clears rect of surface to transparent black and draws items overlapping it
+void RenderDrawRect(const RenderList &list, const Surface &surface, const Rect &rect);
+// Worker threads sharing RenderDraw of large repaints, 0 uses one per CPU
+void RenderInitThreads(int count);
+void RenderDeinitThreads();
+bool RenderDraw(const RenderList &list, Display *display);
+bool RenderDrawFrom(const RenderList &list, const Surface &frame, const RenderList &frameList, Display *display);
+
+} // namespace
+
+#endif
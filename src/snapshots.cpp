@@ -0,0 +1,171 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+
+#include "basetypes.h"
+#include "logs.h"
+#include "snapshots.h"
+#include "render.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <unordered_map>
+
+namespace MpvGui {
+
+#define DEFAULT_SNAPSHOTS_BUDGET (32 * 1024 * 1024)
+// default budget grows with display mode, frame with list entries is more than frame
+#define DEFAULT_SNAPSHOTS_FRAMES 3
+
+typedef struct {
+	std::string                 key;
+	std::string                 path;
+	U64                         generation;
+	std::shared_ptr<Snapshot>   snapshot;
+	U32                         bytes;
+} SnapshotEntry;
+
+static std::list<SnapshotEntry> lruList;
+static std::unordered_map<std::string, std::list<SnapshotEntry>::iterator> snapshotsMap;
+static U32 snapshotsBudget = DEFAULT_SNAPSHOTS_BUDGET;
+static bool snapshotsBudgetSet;     // given by user, kept for any frame size
+static bool snapshotsTooLarge;
+static U32 snapshotsBytes;
+
+static void freeSnapshot(Snapshot *snapshot) {
+	free(snapshot->surface.ptr);
+	delete snapshot;
+}
+
+static void erase(std::list<SnapshotEntry>::iterator it) {
+	snapshotsBytes -= it->bytes;
+	snapshotsMap.erase(it->key);
+	lruList.erase(it);
+}
+
+static void evict() {
+	// unlike labels nothing is kept over budget, 0 disables cache
+	while (snapshotsBytes > snapshotsBudget && !lruList.empty())
+		erase(std::prev(lruList.end()));
+}
+
+void SnapshotsSetBudget(U32 bytes) {
+	snapshotsBudget = bytes;
+	snapshotsBudgetSet = true;
+	evict();
+}
+
+void SnapshotsFlush() {
+	snapshotsMap.clear();
+	lruList.clear();
+	snapshotsBytes = 0;
+}
+
+static std::string makeKey(const std::string &path, int offset, int selection, U64 generation) {
+	std::string key;
+	key.reserve(path.size() + sizeof(offset) + sizeof(selection) + sizeof(generation));
+	key.append((const char *)&offset, sizeof(offset));
+	key.append((const char *)&selection, sizeof(selection));
+	key.append((const char *)&generation, sizeof(generation));
+	key.append(path);
+	return key;
+}
+
+void SnapshotsStore(const std::string &path, int offset, int selection, U64 generation,
+                    const RenderList &list, Display *display) {
+	U32 width = display->getBufferWidth();
+	U32 height = display->getBufferHeight();
+	PIXEL_FORMAT format = display->getBufferFormat();
+	U32 stride = width * BlitGetBytesPerPixel(format);
+	const U8 *src = (const U8 *)display->getBufferPtr();
+	std::string key = makeKey(path, offset, selection, generation);
+
+	if (!snapshotsBudgetSet)
+		snapshotsBudget = MAX(DEFAULT_SNAPSHOTS_BUDGET, DEFAULT_SNAPSHOTS_FRAMES * stride * height);
+	if (stride * height > snapshotsBudget) {
+		if (!snapshotsTooLarge)
+			log->printf("SnapshotsStore(): %ux%u frame exceeds budget, snapshots disabled\n", width, height);
+		snapshotsTooLarge = true;
+		return;
+	}
+
+	auto it = snapshotsMap.find(key);
+	if (it != snapshotsMap.end())
+		erase(it->second);
+
+	Snapshot *snapshot = new Snapshot;
+	snapshot->surface = { (U8 *)malloc(stride * height), width, height, stride, format };
+	if (!snapshot->surface.ptr) {
+		log->printf("SnapshotsStore(): Failed alloc snapshot %ux%u\n", width, height);
+		delete snapshot;
+		return;
+	}
+	// back buffer without last frame, or in memory slow to read like scanout
+	// buffer, is replaced by drawing frame again from its list
+	if (src && display->isBufferReadable()) {
+		for (U32 y = 0; y < height; y++)
+			memcpy(snapshot->surface.ptr + y * stride, src + y * display->getBufferStride(), stride);
+	} else {
+		RenderDrawRect(list, snapshot->surface, { 0, 0, (S32)width, (S32)height });
+	}
+	snapshot->list = list;
+
+	SnapshotEntry entry;
+	entry.key = key;
+	entry.path = path;
+	entry.generation = generation;
+	entry.snapshot = std::shared_ptr<Snapshot>(snapshot, freeSnapshot);
+	entry.bytes = stride * height + sizeof(Snapshot) + list.size() * sizeof(RenderItem) + key.size();
+	lruList.push_front(entry);
+	snapshotsMap[key] = lruList.begin();
+	snapshotsBytes += entry.bytes;
+	evict();
+}
+
+// Frames of other size or format, after display was reinitialized, are not usable
+std::shared_ptr<Snapshot> SnapshotsGet(const std::string &path, int offset, int selection, U64 generation,
+                                       Display *display) {
+	auto it = snapshotsMap.find(makeKey(path, offset, selection, generation));
+	if (it == snapshotsMap.end())
+		return nullptr;
+
+	const Surface &surface = it->second->snapshot->surface;
+	if (surface.width != display->getBufferWidth() || surface.height != display->getBufferHeight() ||
+	    surface.format != display->getBufferFormat()) {
+		erase(it->second);
+		return nullptr;
+	}
+	lruList.splice(lruList.begin(), lruList, it->second);
+
+	return it->second->snapshot;
+}
+
+void SnapshotsInvalidate(const std::string &path, U64 generation) {
+	for (auto it = lruList.begin(); it != lruList.end(); ) {
+		auto next = std::next(it);
+		if (it->path == path && it->generation != generation)
+			erase(it);
+		it = next;
+	}
+}
+
+} // namespace
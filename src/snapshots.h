@@ -0,0 +1,54 @@
+/*
+ * MobiAqua MPV GUI
+ *
+ * Copyright (C) 2024 Pawel Kolodziejski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+
+#ifndef SNAPSHOTS_H
+#define SNAPSHOTS_H
+
+#include <string>
+#include <memory>
+
+#include "basetypes.h"
+#include "display_base.h"
+#include "render.h"
+
+namespace MpvGui {
+
+// Finished frame of a view, kept to show it again without drawing
+typedef struct {
+	Surface         surface;     // pixels in frame buffer format, owned by snapshot
+	RenderList      list;        // items frame was drawn from
+} Snapshot;
+
+void SnapshotsSetBudget(U32 bytes);
+void SnapshotsFlush();
+// Captures back buffer expected to hold frame drawn from list, or draws
+// list again when buffer can not be read back
+void SnapshotsStore(const std::string &path, int offset, int selection, U64 generation,
+                    const RenderList &list, Display *display);
+std::shared_ptr<Snapshot> SnapshotsGet(const std::string &path, int offset, int selection, U64 generation,
+                                       Display *display);
+// Drops snapshots of path taken while it had other listing
+void SnapshotsInvalidate(const std::string &path, U64 generation);
+
+} // namespace
+
+#endif